@@ -0,0 +1,200 @@
+// Microbenchmark: route execution on the tree-walker vs the bytecode VM
+//
+//   make bench && ./build/bench-interpreter [iterations] [file.bub ...]
+//
+// Without files, runs a built-in set of routes. Parameterised routes get
+// "42" for every path parameter. bench/fibonacci.bub times function calls
+// and loops; give it fewer iterations. Memo functions share one cache
+// across iterations and both engines, as they do across requests.
+
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "bytecode.h"
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *default_source =
+    "route \"/hello\" {\n"
+    "    greeting = \"Hello\"\n"
+    "    name = \"World\"\n"
+    "    message = greeting + \", \" + name + \"!\"\n"
+    "    response message\n"
+    "}\n"
+    "route \"/calc\" {\n"
+    "    x = 10\n"
+    "    y = 5\n"
+    "    sum = x + y\n"
+    "    product = x * y\n"
+    "    result = \"Sum: \" + sum + \", Product: \" + product\n"
+    "    response result\n"
+    "}\n"
+    "route \"/invoice\" {\n"
+    "    price = 99.99\n"
+    "    quantity = 3\n"
+    "    tax_rate = 0.08\n"
+    "    subtotal = price * quantity\n"
+    "    tax = subtotal * tax_rate\n"
+    "    shipping = 4.99\n"
+    "    discount = subtotal * 0.1\n"
+    "    total = subtotal + tax + shipping - discount\n"
+    "    big = total > 250\n"
+    "    result = \"Total: $\" + total + \" (tax \" + tax + \", large order: \" + big + \")\"\n"
+    "    response result\n"
+    "}\n"
+    "route \"/users/:id\" {\n"
+    "    name = \"User \" + id\n"
+    "    email = id + \"@example.com\"\n"
+    "    info = name + \" <\" + email + \">\"\n"
+    "    response html {\n"
+    "        info\n"
+    "    }\n"
+    "}\n";
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *source = (char *)malloc(size + 1);
+    source[fread(source, 1, size, file)] = '\0';
+    fclose(file);
+    return source;
+}
+
+static int count_params(const char *path)
+{
+    int count = 0;
+    for (const char *p = strstr(path, "/:"); p; p = strstr(p + 1, "/:"))
+    {
+        if (p[2] != '/' && p[2] != '\0')
+            count++;
+    }
+    return count;
+}
+
+// Run one route iterations times; returns ns per execution
+static double run_route(Interpreter *interp, RouteResponse *response, ASTNode *route,
+                        const BytecodeProgram *bytecode, uint32_t index, long iterations,
+                        size_t *bytes)
+{
+    int params = count_params(route->data.route.path);
+    double start = now_seconds();
+
+    for (long i = 0; i < iterations; i++)
+    {
+        Value *frame = interpreter_enter_route(interp, route);
+        for (int p = 0; p < params && p < route->data.route.slot_count; p++)
+        {
+            frame[p] = value_borrow_string("42");
+        }
+
+        if (bytecode)
+            vm_execute(bytecode, index, interp);
+        else
+            execute_statement(interp, route->data.route.body);
+
+        *bytes += response->body.len;
+        route_response_reset(response);
+        interpreter_reset(interp);
+    }
+
+    return (now_seconds() - start) * 1e9 / iterations;
+}
+
+static int bench_source(const char *name, const char *source, long iterations)
+{
+    Lexer *lexer = lexer_init(source);
+    Parser *parser = parser_init(lexer);
+    ASTNode *program = parser_parse(parser);
+    if (!program)
+    {
+        diagnostics_print(&parser->diagnostics, name, stderr);
+        return 1;
+    }
+    optimize_program(program);
+    resolve_program(program);
+    BytecodeProgram *bytecode = bytecode_compile(program);
+    if (!bytecode)
+    {
+        fprintf(stderr, "%s: compilation failed\n", name);
+        return 1;
+    }
+
+    Interpreter *interp = interpreter_init();
+    RouteResponse response;
+    route_response_init(&response);
+    interp->response = &response;
+    interp->memo = memo_cache_create(MEMO_DEFAULT_ENTRIES);
+
+    double tree_total = 0, vm_total = 0;
+    size_t tree_bytes = 0, vm_bytes = 0;
+
+    printf("%s\n", name);
+    printf("  %-28s %12s %12s %8s\n", "route", "tree ns", "vm ns", "speedup");
+    for (int i = 0; i < program->data.program.route_count; i++)
+    {
+        ASTNode *route = program->data.program.routes[i];
+        double tree = run_route(interp, &response, route, NULL, i, iterations, &tree_bytes);
+        double vm = run_route(interp, &response, route, bytecode, i, iterations, &vm_bytes);
+        tree_total += tree;
+        vm_total += vm;
+        printf("  %-28s %12.1f %12.1f %7.2fx\n", route->data.route.path, tree, vm, tree / vm);
+    }
+    printf("  %-28s %12.1f %12.1f %7.2fx\n\n", "all routes", tree_total, vm_total,
+           tree_total / vm_total);
+
+    if (tree_bytes != vm_bytes)
+        fprintf(stderr, "%s: tree-walker and VM produced different output sizes\n", name);
+
+    route_response_free(&response);
+    memo_cache_free(interp->memo);
+    interpreter_free(interp);
+    bytecode_free(bytecode);
+    ast_free(program);
+    parser_free(parser);
+    lexer_free(lexer);
+    return tree_bytes != vm_bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = 500000;
+    int first_file = 1;
+    if (argc > 1 && atol(argv[1]) > 0)
+    {
+        iterations = atol(argv[1]);
+        first_file = 2;
+    }
+
+    if (first_file >= argc)
+        return bench_source("built-in routes", default_source, iterations);
+
+    int failed = 0;
+    for (int i = first_file; i < argc; i++)
+    {
+        char *source = read_file(argv[i]);
+        if (!source)
+        {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        failed |= bench_source(argv[i], source, iterations);
+        free(source);
+    }
+    return failed;
+}
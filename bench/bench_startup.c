@@ -0,0 +1,229 @@
+// Startup benchmark: time to load a large program, phase by phase
+//
+//   make bench && ./build/bench-startup [routes] [runs]
+//
+// Generates a synthetic program with the given number of routes (default
+// 10000, about 1.5 MB of source) and reports the best of several runs for
+// each phase the server goes through before it can answer a request, and
+// for loading the same program precompiled into an image (image.h).
+
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "bytecode.h"
+#include "router.h"
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append(char **buf, size_t *len, size_t *cap, const char *text)
+{
+    size_t n = strlen(text);
+    if (*len + n + 1 > *cap)
+    {
+        *cap = (*len + n + 1) * 2;
+        *buf = (char *)realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, text, n + 1);
+    *len += n;
+}
+
+// A mix of the route shapes real programs have: constant text, path
+// parameters, arithmetic, branches, loops, HTML and function calls
+static char *generate_source(int routes, size_t *length)
+{
+    size_t len = 0, cap = 0;
+    char *buf = NULL;
+    char line[512];
+
+    append(&buf, &len, &cap,
+           "// Generated by bench-startup\n"
+           "function price_with_tax(price, rate) {\n"
+           "    return price + price * rate\n"
+           "}\n"
+           "\n"
+           "function label(kind, id) {\n"
+           "    if kind == \"admin\" {\n"
+           "        return \"Admin #\" + id\n"
+           "    }\n"
+           "    return \"User #\" + id\n"
+           "}\n\n");
+
+    for (int i = 0; i < routes; i++)
+    {
+        switch (i % 4)
+        {
+        case 0:
+            snprintf(line, sizeof(line),
+                     "route \"/static/page%d\" {\n"
+                     "    response \"Page %d of the generated site\"\n"
+                     "}\n\n",
+                     i, i);
+            break;
+        case 1:
+            snprintf(line, sizeof(line),
+                     "route \"GET /api/v1/items%d/:id\" {\n"
+                     "    // Look the item up and price it\n"
+                     "    base = id * %d\n"
+                     "    total = price_with_tax(base, 0.2)\n"
+                     "    response \"Item \" + id + \" costs \" + total\n"
+                     "}\n\n",
+                     i, i % 97 + 1);
+            break;
+        case 2:
+            snprintf(line, sizeof(line),
+                     "route \"/users%d/:kind/:id\" {\n"
+                     "    name = label(kind, id)\n"
+                     "    if id > %d && kind != \"guest\" {\n"
+                     "        response html {\n"
+                     "            name\n"
+                     "        }\n"
+                     "    } else {\n"
+                     "        response \"Hello, \" + name\n"
+                     "    }\n"
+                     "}\n\n",
+                     i, i % 50);
+            break;
+        default:
+            snprintf(line, sizeof(line),
+                     "route \"POST /reports%d/:n\" {\n"
+                     "    count = 0\n"
+                     "    sum = 0\n"
+                     "    while count < n {\n"
+                     "        sum = sum + count * %d\n"
+                     "        count = count + 1\n"
+                     "    }\n"
+                     "    response \"Report %d: \" + sum\n"
+                     "}\n\n",
+                     i, i % 13 + 1, i);
+            break;
+        }
+        append(&buf, &len, &cap, line);
+    }
+
+    *length = len;
+    return buf;
+}
+
+typedef struct {
+    double tokenize;
+    double parse;     // Lexing included, as the parser pulls its own tokens
+    double resolve;   // Optimizer and resolver
+    double compile;   // Bytecode and route trie
+    double image;     // Mapping and checking the precompiled image
+} Timings;
+
+static void keep_best(double *best, double value)
+{
+    if (*best == 0 || value < *best)
+        *best = value;
+}
+
+static int run_once(const char *source, size_t length, const char *image_path, Timings *best,
+                    int *token_count)
+{
+    double start = now_seconds();
+    Lexer *lexer = lexer_init_len(source, length);
+    TokenList tokens;
+    lexer_tokenize(lexer, &tokens);
+    keep_best(&best->tokenize, now_seconds() - start);
+    *token_count = tokens.count;
+    token_list_free(&tokens);
+    lexer_free(lexer);
+
+    start = now_seconds();
+    lexer = lexer_init_len(source, length);
+    Parser *parser = parser_init(lexer);
+    ASTNode *program = parser_parse(parser);
+    keep_best(&best->parse, now_seconds() - start);
+    if (!program)
+    {
+        diagnostics_print(&parser->diagnostics, "generated", stderr);
+        return 0;
+    }
+
+    start = now_seconds();
+    optimize_program(program);
+    resolve_program(program);
+    keep_best(&best->resolve, now_seconds() - start);
+
+    start = now_seconds();
+    BytecodeProgram *bytecode = bytecode_compile(program);
+    Router *router = router_compile(program);
+    keep_best(&best->compile, now_seconds() - start);
+
+    int ok = bytecode != NULL && image_write(image_path, bytecode, router) == 0;
+    router_free(router);
+    bytecode_free(bytecode);
+    ast_free(program);
+    parser_free(parser);
+    lexer_free(lexer);
+    if (!ok)
+        return 0;
+
+    start = now_seconds();
+    ProgramImage *image = image_open(image_path);
+    keep_best(&best->image, now_seconds() - start);
+    ok = image != NULL;
+    image_close(image);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int routes = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 10000;
+    int runs = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 5;
+
+    size_t length;
+    char *source = generate_source(routes, &length);
+
+    char image_path[] = "/tmp/bench-startup-XXXXXX";
+    int fd = mkstemp(image_path);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    Timings best = {0, 0, 0, 0, 0};
+    int token_count = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        if (!run_once(source, length, image_path, &best, &token_count))
+        {
+            fprintf(stderr, "Compilation failed\n");
+            return 1;
+        }
+    }
+
+    double mb = length / (1024.0 * 1024.0);
+    printf("%d routes, %.2f MB, %d tokens (best of %d runs)\n", routes, mb, token_count, runs);
+    printf("  %-24s %10.2f ms %10.1f MB/s\n", "tokenize", best.tokenize * 1e3, mb / best.tokenize);
+    printf("  %-24s %10.2f ms %10.1f MB/s\n", "lex + parse", best.parse * 1e3, mb / best.parse);
+    printf("  %-24s %10.2f ms\n", "optimize + resolve", best.resolve * 1e3);
+    printf("  %-24s %10.2f ms\n", "bytecode + router", best.compile * 1e3);
+    double total = best.parse + best.resolve + best.compile;
+    printf("  %-24s %10.2f ms\n", "total (without tokenize)", total * 1e3);
+
+    struct stat st;
+    stat(image_path, &st);
+    printf("  %-24s %10.2f ms %10.1fx faster (%.2f MB image)\n", "image load", best.image * 1e3,
+           total / best.image, st.st_size / (1024.0 * 1024.0));
+
+    unlink(image_path);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for memory that dies all at once. Blocks are kept across
+// arena_reset, so a reused arena stops calling malloc once it has grown to
+// its working size, and a reset is O(1) however much was allocated.
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t cap;
+    size_t used;
+    // Data follows, aligned to ARENA_ALIGNMENT
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    ArenaBlock *current;
+    size_t block_size;
+} Arena;
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+void arena_init(Arena *arena, size_t block_size);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *str);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
+#include "intern.h"
+
 // Types of AST nodes
 typedef enum {
     AST_PROGRAM,
@@ -19,25 +22,57 @@ typedef enum {
     AST_RETURN
 } ASTNodeType;
 
+// Binary operators
+typedef enum {
+    BINOP_ADD,
+    BINOP_SUB,
+    BINOP_MUL,
+    BINOP_DIV,
+    BINOP_LT,
+    BINOP_GT,
+    BINOP_LTE,
+    BINOP_GTE,
+    BINOP_EQ,
+    BINOP_NEQ,
+    BINOP_AND,
+    BINOP_OR,
+    BINOP_UNKNOWN
+} BinaryOperator;
+
 // Forward declaration
 typedef struct ASTNode ASTNode;
 
+// Memory for one program's tree. Nodes and child lists are bump-allocated
+// in parse order, so the tree sits in a few large blocks and ast_free
+// releases it in one go. Names, paths and string literals are interned:
+// two names are equal exactly when their pointers are.
+typedef struct {
+    Arena nodes;
+    InternTable strings;
+} ASTArena;
+
 // AST Node structure
 struct ASTNode {
     ASTNodeType type;
     
     // Different data depending on node type
     union {
-        // For AST_PROGRAM: list of routes
+        // For AST_PROGRAM: list of routes and the function table
         struct {
             ASTNode **routes;
             int route_count;
+            ASTNode **functions;
+            int function_count;
+            ASTArena *arena; // Owns every node and string of the tree
         } program;
         
         // For AST_ROUTE: path and body
         struct {
             char *path;
             ASTNode *body;  // Block node
+            int slot_count; // Frame size assigned by the resolver
+            int resolved;   // Set by the resolver: path parameters take the first slots
+            int is_constant; // Body only sends constant responses (optimizer.h)
         } route;
         
         // For AST_RESPONSE: value
@@ -50,11 +85,13 @@ struct ASTNode {
         struct {
             char *name;
             ASTNode *value;
+            int slot;       // Frame slot, or -1 if unresolved
         } assignment;
         
         // For AST_IDENTIFIER
         struct {
             char *name;
+            int slot;       // Frame slot, or -1 if unresolved
         } identifier;
         
         // For AST_STRING
@@ -75,7 +112,7 @@ struct ASTNode {
         
         // For AST_BINARY_OP: left op right
         struct {
-            char *operator;
+            BinaryOperator op;
             ASTNode *left;
             ASTNode *right;
         } binary_op;
@@ -99,6 +136,10 @@ struct ASTNode {
             char **params;
             int param_count;
             ASTNode *body;
+            int slot_count; // Frame size; parameters take the first slots
+            int index;      // Position in the program's function table
+            int memo;       // "memo function": cache results by arguments
+            int pure;       // Set by the resolver; memo is cleared if not
         } function;
         
         // For AST_FUNCTION_CALL: name, arguments
@@ -106,6 +147,7 @@ struct ASTNode {
             char *name;
             ASTNode **args;
             int arg_count;
+            ASTNode *target; // Function called, set by the resolver; NULL if undefined
         } function_call;
         
         // For AST_RETURN: value
@@ -115,26 +157,30 @@ struct ASTNode {
     } data;
 };
 
-// AST node creation functions
+// AST node creation functions. The program owns the arena; every other
+// node is created in it. Lists passed in are copied, and strings interned.
 ASTNode* ast_create_program();
-ASTNode* ast_create_route(char *path, ASTNode *body);
-ASTNode* ast_create_response(ASTNode *value, int is_html);
-ASTNode* ast_create_assignment(char *name, ASTNode *value);
-ASTNode* ast_create_identifier(char *name);
-ASTNode* ast_create_string(char *value);
-ASTNode* ast_create_number(double value);
-ASTNode* ast_create_block();
-ASTNode* ast_create_binary_op(const char *operator, ASTNode *left, ASTNode *right);
-ASTNode* ast_create_if(ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch);
-ASTNode* ast_create_while(ASTNode *condition, ASTNode *body);
-ASTNode* ast_create_function(const char *name, char **params, int param_count, ASTNode *body);
-ASTNode* ast_create_function_call(const char *name, ASTNode **args, int arg_count);
-ASTNode* ast_create_return(ASTNode *value);
+ASTNode* ast_create_route(ASTArena *arena, const char *path, ASTNode *body);
+ASTNode* ast_create_response(ASTArena *arena, ASTNode *value, int is_html);
+ASTNode* ast_create_assignment(ASTArena *arena, const char *name, ASTNode *value);
+ASTNode* ast_create_identifier(ASTArena *arena, const char *name);
+ASTNode* ast_create_string(ASTArena *arena, const char *value);
+ASTNode* ast_create_number(ASTArena *arena, double value);
+ASTNode* ast_create_block(ASTArena *arena, ASTNode **statements, int statement_count);
+ASTNode* ast_create_binary_op(ASTArena *arena, BinaryOperator op, ASTNode *left, ASTNode *right);
+ASTNode* ast_create_if(ASTArena *arena, ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch);
+ASTNode* ast_create_while(ASTArena *arena, ASTNode *condition, ASTNode *body);
+ASTNode* ast_create_function(ASTArena *arena, const char *name, const char **params, int param_count,
+                             ASTNode *body);
+ASTNode* ast_create_function_call(ASTArena *arena, const char *name, ASTNode **args, int arg_count);
+ASTNode* ast_create_return(ASTArena *arena, ASTNode *value);
 
 // Helper functions
-void ast_program_add_route(ASTNode *program, ASTNode *route);
-void ast_block_add_statement(ASTNode *block, ASTNode *statement);
-void ast_free(ASTNode *node);
+const char* binary_operator_symbol(BinaryOperator op);
+void ast_program_set_routes(ASTNode *program, ASTNode **routes, int count);
+void ast_program_set_functions(ASTNode *program, ASTNode **functions, int count);
+void ast_block_set_statements(ASTArena *arena, ASTNode *block, ASTNode **statements, int count);
+void ast_free(ASTNode *program);   // Frees the whole tree; other nodes go with it
 void ast_print(ASTNode *node, int indent);
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef BYTEBUFFER_H
+#define BYTEBUFFER_H
+
+#include <stddef.h>
+
+// Growable byte buffer. Reset keeps the allocation, so a buffer reused
+// across requests stops allocating once it has grown to the largest
+// response it has held. Contents are binary-safe and not NUL-terminated.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} ByteBuffer;
+
+void bytebuffer_init(ByteBuffer *buf);
+void bytebuffer_free(ByteBuffer *buf);
+void bytebuffer_reset(ByteBuffer *buf);
+char *bytebuffer_reserve(ByteBuffer *buf, size_t extra);  // Returns the write position
+void bytebuffer_append(ByteBuffer *buf, const void *data, size_t len);
+void bytebuffer_append_str(ByteBuffer *buf, const char *str);
+void bytebuffer_appendf(ByteBuffer *buf, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+#include "interpreter.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Stack bytecode for route and function bodies. Instructions are 32-bit words: the
+// opcode in the low 8 bits and one operand in the upper 24. Constants are
+// referenced by index and jumps are relative, so the whole program is
+// position-independent and can be written out or mapped as-is.
+
+#define BYTECODE_OPS(X)                                                     \
+    X(OP_PUSH_STRING)   /* push string constant [arg]                   */ \
+    X(OP_PUSH_NUMBER)   /* push number constant [arg]                   */ \
+    X(OP_PUSH_NULL)                                                         \
+    X(OP_PUSH_BOOL)     /* push bool [arg]                              */ \
+    X(OP_POP)                                                               \
+    X(OP_LOAD)          /* push frame slot [arg]                        */ \
+    X(OP_STORE)         /* pop into frame slot [arg]                    */ \
+    X(OP_LOAD_NAME)     /* push variable named by string [arg]          */ \
+    X(OP_STORE_NAME)    /* pop into variable named by string [arg]      */ \
+    X(OP_APPEND_NAME)   /* append variable [arg] to top, if defined     */ \
+    X(OP_CONCAT)        /* pop b, a; push text of a + text of b         */ \
+    X(OP_ADD)                                                               \
+    X(OP_SUB)                                                               \
+    X(OP_MUL)                                                               \
+    X(OP_DIV)                                                               \
+    X(OP_LT)                                                                \
+    X(OP_GT)                                                                \
+    X(OP_LTE)                                                               \
+    X(OP_GTE)                                                               \
+    X(OP_EQ)                                                                \
+    X(OP_NEQ)                                                               \
+    X(OP_BINARY)        /* pop b, a; push a <BinaryOperator arg> b      */ \
+    X(OP_RESPOND)       /* pop value, write it as text/plain            */ \
+    X(OP_RESPOND_HTML)  /* pop value, write it wrapped in HTML          */ \
+    X(OP_JUMP)          /* ip += signed [arg]                           */ \
+    X(OP_JUMP_IF_FALSE) /* pop value; jump if it is falsy               */ \
+    X(OP_JUMP_IF_TRUE)  /* pop value; jump if it is truthy              */ \
+    X(OP_CALL)          /* call function [arg]; its arguments are on    */ \
+                        /* the stack and become its first frame slots   */ \
+    X(OP_CALL_MEMO)     /* OP_CALL through the memo cache               */ \
+    X(OP_TAILCALL)      /* call function [arg] in place of this one     */ \
+    X(OP_CALL_MISSING)  /* report undefined function [arg]; push null  */ \
+    X(OP_RETURN)        /* pop value and return it to the caller        */ \
+    X(OP_HALT)
+
+typedef enum {
+#define BYTECODE_ENUM(op) op,
+    BYTECODE_OPS(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+    OP_COUNT
+} Opcode;
+
+typedef uint32_t Instruction;
+
+#define INSTR(op, arg) ((Instruction)(op) | ((Instruction)(arg) << 8))
+#define INSTR_OP(ins) ((ins) & 0xff)
+#define INSTR_ARG(ins) ((ins) >> 8)
+#define INSTR_SARG(ins) ((int32_t)(ins) >> 8)   // Jump offsets, from the next instruction
+#define INSTR_MAX_ARG 0xffffff
+#define INSTR_MAX_JUMP 0x7fffff
+
+typedef struct {
+    uint32_t code_start;   // Index of the route's first instruction
+    uint32_t code_len;
+    uint32_t slot_count;   // Frame size, as assigned by the resolver
+    uint32_t max_stack;    // Deepest the operand stack gets
+    uint32_t path;         // String constant: the pattern, "METHOD /path" or "/path"
+    uint32_t resolved;     // route.resolved: path parameters go in the first slots, not by name
+    uint32_t is_constant;  // route.is_constant, see optimizer.h
+} BytecodeRoute;
+
+typedef struct {
+    uint32_t code_start;
+    uint32_t code_len;
+    uint32_t name;         // String constant
+    uint32_t param_count;
+    uint32_t slot_count;   // Parameters first, then locals
+    uint32_t max_stack;
+    uint32_t memo;         // Called through OP_CALL_MEMO
+} BytecodeFunction;
+
+// Operands an instruction pops and then pushes. Calls pop their callee's
+// parameters, looked up in functions. The compiler tracks each body's
+// max_stack with this, and loading an image checks the image's bodies
+// against it (see image.h).
+void bytecode_stack_effect(Instruction ins, const BytecodeFunction *functions,
+                           uint32_t *pops, uint32_t *pushes);
+
+// Compiled program: one bytecode body per route and per function, each in
+// program order. It carries everything needed to serve the routes, so it
+// can run without the AST (see image.h). Equal string constants are stored
+// once.
+typedef struct {
+    Instruction *code;
+    uint32_t code_len;
+    double *numbers;
+    uint32_t number_count;
+    uint32_t *strings;     // Offset of each string constant in pool
+    uint32_t string_count;
+    char *pool;            // NUL-terminated string constants
+    uint32_t pool_len;
+    BytecodeRoute *routes;
+    uint32_t route_count;
+    BytecodeFunction *functions;  // Indexed by the resolver's function index
+    uint32_t function_count;
+} BytecodeProgram;
+
+// Compile every route and function of a resolved program; see resolver.h
+BytecodeProgram *bytecode_compile(ASTNode *program);
+void bytecode_free(BytecodeProgram *program);
+void bytecode_disassemble(const BytecodeProgram *program, FILE *out);
+
+// Run one route. The route's frame must already be entered (and any path
+// parameters stored) with interpreter_enter_route. Function frames and
+// operands go on the interpreter's value stack above it.
+void vm_execute(const BytecodeProgram *program, uint32_t route, Interpreter *interp);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <stdio.h>
+
+// Errors found in a program's source, collected for the caller instead of
+// ending the process, so a bad program can be reported and rejected
+// without taking down whoever was loading it.
+
+#define DIAGNOSTIC_MESSAGE_SIZE 160
+
+typedef struct {
+    int line;              // 1-based
+    int column;            // 1-based
+    char message[DIAGNOSTIC_MESSAGE_SIZE];  // Truncated to fit
+} Diagnostic;
+
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int capacity;
+} DiagnosticList;
+
+void diagnostics_init(DiagnosticList *list);
+void diagnostics_free(DiagnosticList *list);
+void diagnostics_add(DiagnosticList *list, int line, int column, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// One "name:line:column: error: message" line per diagnostic
+void diagnostics_print(const DiagnosticList *list, const char *name, FILE *output);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include "strview.h"
+
+#define HTTP_MAX_HEADERS 64
+#define HTTP_MAX_HEADER_BYTES (16 * 1024)   // Request line + headers
+#define HTTP_MAX_BODY_BYTES (1024 * 1024)   // Decoded body
+#define HTTP_MAX_FRAMING_BYTES (8 * 1024 * 1024)  // Chunk sizes, extensions, CRLFs and trailers
+
+// Result of feeding bytes to the parser
+typedef enum {
+    HTTP_PARSE_COMPLETE,    // A whole request is available
+    HTTP_PARSE_INCOMPLETE,  // Need more bytes; call again with the grown buffer
+    HTTP_PARSE_ERROR        // Malformed or too large; see error_status
+} HTTPParseStatus;
+
+typedef struct {
+    StrView name;
+    StrView value;
+} HTTPHeader;
+
+// HTTP request. Every StrView points into the caller's read buffer, so the
+// request is only valid while that buffer is (the parser never allocates).
+typedef struct {
+    StrView method;    // GET, POST, etc.
+    StrView path;      // /hello, /user, etc. (without the query string)
+    StrView query;     // Text after '?', empty if none
+    StrView version;   // HTTP/1.1
+    HTTPHeader headers[HTTP_MAX_HEADERS];
+    int header_count;
+    StrView body;      // Decoded body (chunked bodies are de-chunked in place)
+    int keep_alive;    // Client wants the connection kept open
+    int expect_continue;  // Client sent "Expect: 100-continue"
+    int error_status;     // HTTP status to answer with after HTTP_PARSE_ERROR
+    size_t length;        // Raw bytes the request occupies once complete
+
+    // Parser state, kept so parsing resumes where the last call stopped
+    int state;
+    const char *base;        // Buffer the views point into
+    size_t head_start;       // Offset after any leading blank lines
+    size_t scan_pos;         // Where the search for the end of headers resumes
+    size_t head_len;         // Offset just past the blank line ending headers
+    size_t content_length;
+    int chunked;
+    size_t chunk_pos;        // Offset of the next raw chunked byte to decode
+    size_t chunk_remaining;  // Data bytes left in the current chunk
+    size_t framing_len;      // Chunk framing consumed so far
+} HTTPRequest;
+
+// Header scanning implementation, chosen automatically at startup
+typedef enum {
+    HTTP_SIMD_SCALAR,
+    HTTP_SIMD_SSE42,
+    HTTP_SIMD_AVX2
+} HTTPSimdLevel;
+
+HTTPSimdLevel http_parser_simd_supported();
+HTTPSimdLevel http_parser_set_simd(HTTPSimdLevel level);  // Clamped to CPU support; not thread-safe
+HTTPSimdLevel http_parser_simd_level();
+const char *http_parser_simd_name(HTTPSimdLevel level);
+
+void http_request_init(HTTPRequest *request);
+HTTPParseStatus http_request_parse(HTTPRequest *request, char *buf, size_t len);
+
+// After HTTP_PARSE_INCOMPLETE: drop the chunk framing already decoded from
+// buf by moving the unparsed bytes down over it, and return the new length
+// of buf. The request then takes about as much buffer as its decoded body,
+// however small its chunks are.
+size_t http_request_compact(HTTPRequest *request, char *buf, size_t len);
+const StrView *http_request_header(const HTTPRequest *request, const char *name);
+
+#endif
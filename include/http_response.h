@@ -0,0 +1,36 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include "bytebuffer.h"
+#include "strview.h"
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Response serialization. Only the head (status line and headers) is ever
+// built; the body stays in whatever buffer produced it and is handed to
+// the socket alongside the head as a second iovec.
+
+#define HTTP_RESPONSE_IOV_COUNT 2
+
+// Reason phrase for a status code, or "" for codes without a standard one
+const char *http_status_reason(int status_code);
+
+// Non-zero if responses with this status carry a body: all but 1xx, 204
+// and 304
+int http_status_has_body(int status_code);
+
+// Append the head of a response to head. Any 3-digit status code is
+// accepted (others become 500); extra_headers holds complete header lines,
+// each ending in "\r\n", and may be NULL. Statuses without a body get no
+// Content-Type or Content-Length. A HEAD response passes the length the GET
+// response would have, and is then sent without its body.
+void http_response_write_head(ByteBuffer *head, int status_code, StrView content_type,
+                              size_t content_length, int keep_alive,
+                              const ByteBuffer *extra_headers);
+
+// Fill iov with what remains of head + body after sent bytes.
+// Returns the number of iovecs used (0 when everything has been sent).
+int http_response_iov(const ByteBuffer *head, const ByteBuffer *body, size_t sent,
+                      struct iovec iov[HTTP_RESPONSE_IOV_COUNT]);
+
+#endif
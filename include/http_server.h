@@ -2,47 +2,79 @@
 #define HTTP_SERVER_H
 
 #include "ast.h"
+#include "bytecode.h"
 #include "interpreter.h"
+#include "memo.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "image.h"
+#include "router.h"
+#include <pthread.h>
+#include <stddef.h>
 
-// HTTP request structure
+// Per-thread worker: listening socket, event loop and interpreter
+typedef struct HTTPWorker HTTPWorker;
+
+// Complete serialized response of a constant route (see optimizer.h),
+// built once when the program is loaded. Empty for routes that have to run
+// per request.
 typedef struct {
-    char *method;      // GET, POST, etc.
-    char *path;        // /hello, /user, etc.
-    char *version;     // HTTP/1.1
-    char *headers;     // Raw headers
-    char *body;        // Request body
-} HTTPRequest;
-
-// HTTP response structure
+    ByteBuffer bytes[2];   // Indexed by keep-alive: "close" and "keep-alive"
+    size_t head_len[2];    // Of bytes, which is all a HEAD request gets
+} StaticResponse;
+
+// One version of the program being served, with everything derived from
+// it. Requests read it without locks; a reload swaps in a new one and frees
+// the old one once no worker can still be using it.
 typedef struct {
-    int status_code;
-    char *status_text;
-    char *content_type;
-    char *body;
-} HTTPResponse;
+    ASTNode *program;      // NULL when serving an image
+    ProgramImage *image;   // NULL when serving source
+    int owned;             // program/image were loaded by the server and are freed with it
+    Router *router;        // Route trie compiled from program, or the image's
+    BytecodeProgram *bytecode;  // Route bodies compiled from program, or the image's
+    StaticResponse *static_responses;  // One per route
+    unsigned long *static_hits;        // Per worker and route; see http_server_print_cache_stats
+    MemoCache *memo;       // Shared by all workers; NULL without memo functions
+} ServerProgram;
 
 // HTTP server
 typedef struct {
     int port;
-    int socket_fd;
-    ASTNode *program;
-    Interpreter *interpreter;
+    volatile int running;  // Cleared by http_server_stop to end the loops
+    int log_requests;      // Print "Request: METHOD /path" for each request
+    int keepalive_timeout_ms;    // Close connections idle for longer than this
+    int max_keepalive_requests;  // Close a connection after this many requests
+    ServerProgram *current;      // Read with __atomic_load_n; replaced by reloads
+    const char *path;      // File the program is loaded from (not copied); NULL for one passed in
+    int reload;            // Watch path and serve new versions as they are saved (default)
+    pthread_t reloader;
+    int use_bytecode;      // Run routes on the VM (default) or the tree-walker; images always use the VM
+    int max_call_depth;    // Deeper recursion fails the request with a 500
+    int memo_entries;      // Size of each program's memo function cache; 0 turns it off
+    int worker_count;
+    HTTPWorker *workers;
 } HTTPServer;
 
-// Server functions
+// Server functions. A server created from an AST or image needs it until
+// http_server_free. One created from a file (.bub source or .bubc image, see
+// loader.h) loads the program itself and, while running, reloads it in the
+// background whenever the file changes; NULL if the first load fails.
 HTTPServer* http_server_create(int port, ASTNode *program);
+HTTPServer* http_server_create_from_image(int port, ProgramImage *image);
+HTTPServer* http_server_create_from_file(int port, const char *path);
+void http_server_set_workers(HTTPServer *server, int count);
 void http_server_start(HTTPServer *server);
 void http_server_stop(HTTPServer *server);
 void http_server_free(HTTPServer *server);
 
-// Request/Response functions
-HTTPRequest* http_request_parse(const char *raw_request);
-void http_request_free(HTTPRequest *request);
-HTTPResponse* http_response_create(int status_code, const char *content_type, const char *body);
-char* http_response_to_string(HTTPResponse *response);
-void http_response_free(HTTPResponse *response);
+// Print how often each cached constant route of the current program was
+// served, summed over workers, and the memo function cache's hit rate
+void http_server_print_cache_stats(HTTPServer *server);
 
-// Route matching
-ASTNode* find_matching_route(ASTNode *program, const char *path, Interpreter *interp);
+// Route matching. Returns the index of the matched route, with its frame
+// entered and path parameters stored, or -1 when nothing matched;
+// match->allowed is then non-zero if the path exists for other methods.
+int find_matching_route(const ServerProgram *program, int method, const char *path,
+                        size_t path_len, Interpreter *interp, RouteMatch *match);
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "bytecode.h"
+#include "router.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Precompiled program image (.bubc), written by "webbubble compile". It
+// holds a compiled program's bytecode and route trie exactly as they are
+// laid out in memory. Both are flat arrays linked by index, with all text
+// in string pools, so loading maps the file and points the structs into
+// it: nothing is parsed, copied or fixed up.
+//
+// The file is an ImageHeader followed by the sections it lists, each
+// 8-byte aligned. An image only loads into a build with the same
+// IMAGE_VERSION, opcode count, byte order and section element sizes; bump
+// IMAGE_VERSION whenever the bytecode or router structs change. Loading
+// also checks every index the VM and router follow, including each
+// instruction's operand and jump target, and follows each body's operand
+// stack depth along every path, so a corrupt image is refused rather than
+// run.
+
+#define IMAGE_MAGIC "WBUBBLE"    // 8 bytes with the NUL
+#define IMAGE_VERSION 3
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef enum {
+    IMAGE_CODE,
+    IMAGE_NUMBERS,
+    IMAGE_STRINGS,
+    IMAGE_POOL,
+    IMAGE_ROUTES,
+    IMAGE_FUNCTIONS,
+    IMAGE_ROUTER_NODES,
+    IMAGE_ROUTER_ROUTES,
+    IMAGE_ROUTER_PARAMS,
+    IMAGE_ROUTER_STRINGS,
+    IMAGE_SECTION_COUNT
+} ImageSectionId;
+
+typedef struct {
+    uint64_t offset;       // From the start of the file
+    uint64_t count;        // Elements; bytes for the string pools
+} ImageSection;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;   // IMAGE_BYTE_ORDER, as stored by the writer
+    uint32_t opcode_count; // OP_COUNT of the compiler that wrote it
+    uint32_t header_size;
+    uint64_t size;         // Whole file
+    uint64_t checksum;     // Of everything after the header
+    uint32_t element_sizes[IMAGE_SECTION_COUNT];  // sizeof each section's element type
+    ImageSection sections[IMAGE_SECTION_COUNT];
+} ImageHeader;
+
+// A mapped image. The bytecode and router arrays point into the mapping
+// and stay valid until image_close; never pass them to bytecode_free or
+// router_free.
+typedef struct {
+    void *data;
+    size_t size;
+    BytecodeProgram bytecode;
+    Router router;
+} ProgramImage;
+
+// Returns 0 on success, -1 with a message on stderr
+int image_write(const char *path, const BytecodeProgram *bytecode, const Router *router);
+
+// NULL, with a message on stderr, if the file is missing, corrupt or was
+// written by an incompatible build
+ProgramImage *image_open(const char *path);
+
+// The same for a whole file already mapped read-only, such as one the
+// caller mapped to look at its magic. The image takes over the mapping:
+// image_close unmaps it, and so does a failed open. path is only used in
+// messages.
+ProgramImage *image_open_mapping(const char *path, void *data, size_t size);
+void image_close(ProgramImage *image);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Set of unique strings. Interning the same text twice returns the same
+// pointer, so interned strings compare equal exactly when their pointers
+// do. The strings live in the arena given to intern_init; the table itself
+// only holds the index.
+typedef struct {
+    Arena *arena;
+    char **slots;        // Open addressing; NULL is empty
+    uint32_t *hashes;
+    size_t capacity;     // Power of two
+    size_t count;
+} InternTable;
+
+void intern_init(InternTable *table, Arena *arena);
+void intern_free(InternTable *table);   // The strings stay in the arena
+
+// The unique NUL-terminated copy of str[0..len); never modify it
+char *intern(InternTable *table, const char *str, size_t len);
+char *intern_cstr(InternTable *table, const char *str);
+
+#endif
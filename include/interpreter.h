@@ -1,7 +1,11 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
+#include "arena.h"
 #include "ast.h"
+#include "bytebuffer.h"
+#include "strview.h"
+#include <stdint.h>
 #include <stdio.h>
 
 // Value types that can be stored at runtime
@@ -15,6 +19,7 @@ typedef enum {
 // Runtime value
 typedef struct {
     ValueType type;
+    int borrowed;      // String belongs to an arena or the AST; value_free skips it
     union {
         char *string;
         double number;
@@ -22,32 +27,106 @@ typedef struct {
     } data;
 } Value;
 
-// Variable storage (simple symbol table)
+// Variable storage (simple symbol table). Variables, their names and their
+// string values live in the interpreter's arena, as do all strings built
+// while evaluating, so a request frees nothing until interpreter_reset.
 typedef struct Variable {
     char *name;
     Value value;
     struct Variable *next;
 } Variable;
 
+// Response produced by a route when run by the HTTP server. The buffers
+// belong to the caller and are reset, not freed, between requests.
+typedef struct {
+    int status_code;
+    StrView content_type;      // Points at a static string
+    ByteBuffer headers;        // Extra header lines, each ending in "\r\n"
+    ByteBuffer body;
+} RouteResponse;
+
+// Frames of a route and the functions it calls are carved out of one
+// preallocated value stack, so a call allocates nothing
+#define INTERPRETER_STACK_SLOTS (16 * 1024)
+#define INTERPRETER_MAX_CALL_DEPTH 1000   // Default; see interpreter_set_max_call_depth
+
+typedef struct MemoCache MemoCache;   // See memo.h
+typedef struct MemoKey MemoKey;
+
+// Where a VM call returns to. The VM keeps these in an explicit stack
+// rather than recursing in C, so deep recursion costs no C stack.
+typedef struct {
+    const uint32_t *return_ip;
+    Value *frame;           // Caller's frame
+    const MemoKey *memo;    // Memo function call: cache the result under this key
+} CallFrame;
+
 // Interpreter context
 typedef struct {
-    Variable *variables;  // Linked list of variables
+    Value *frame;         // Slots of the running route or function (see resolver.h)
+    int frame_size;
+    Value *stack;         // Frames (and VM operands), INTERPRETER_STACK_SLOTS long
+    int stack_size;
+    int stack_top;        // First stack slot not in use
+    int call_depth;
+    int max_call_depth;
+    uintptr_t c_stack_limit;  // Tree-walker calls fail below this address; 0 never does
+    CallFrame *calls;     // VM call stack, max_call_depth long
+    int returning;        // A "return" is unwinding to the enclosing call
+    Value return_value;
+    ASTNode *tail_call;   // Function a "return f(...)" continues with
+    char *error;          // Set by interpreter_abort; the route failed
+    MemoCache *memo;      // Shared results of memo functions; NULL runs them uncached
+    Variable *variables;  // Unresolved names only; looked up with strcmp
+    Arena arena;          // Request-scoped memory, released by interpreter_reset
     FILE *output;         // Where to write output (stdout or file)
+    RouteResponse *response;  // When set, "response" writes here instead of output
 } Interpreter;
 
 // Interpreter functions
 Interpreter* interpreter_init();
 void interpreter_free(Interpreter *interp);
+void interpreter_reset(Interpreter *interp);  // Forget all variables, O(1)
 void interpreter_execute(Interpreter *interp, ASTNode *ast);
 void execute_statement(Interpreter *interp, ASTNode *node);  // Exposed for HTTP server
-void set_variable(Interpreter *interp, const char *name, Value value);  // Set variable value
+Value *interpreter_enter_route(Interpreter *interp, ASTNode *route);  // Fresh frame of nulls
+Value *interpreter_enter_frame(Interpreter *interp, int slot_count);  // Same, for compiled routes
+void set_variable(Interpreter *interp, const char *name, Value value);  // Takes ownership of value
+Value *get_variable(Interpreter *interp, const char *name);             // NULL if undefined
+void interpreter_respond(Interpreter *interp, Value *value, int is_html);
+void interpreter_set_max_call_depth(Interpreter *interp, int depth);
+
+// The tree-walker, unlike the VM, recurses on the C stack, so its depth is
+// also bounded by the thread's stack. Let its calls use at most bytes of
+// stack below the caller's frame; a call beyond that fails the route with
+// "Out of stack space", as the VM does when its value stack is full. Call
+// it on the thread that will run the interpreter.
+void interpreter_set_c_stack(Interpreter *interp, size_t bytes);
+
+// Stop the running route with a runtime error. The message is kept in
+// interp->error until interpreter_reset; the HTTP server answers 500.
+void interpreter_abort(Interpreter *interp, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
 
 // Value functions
 Value value_create_string(const char *str);
+Value value_create_string_len(const char *str, size_t len);
+Value value_create_arena_string(Arena *arena, const char *str, size_t len);
 Value value_create_number(double num);
+Value value_create_bool(int boolean);
+Value value_borrow_string(char *str);  // str must outlive the value
 Value value_create_null();
 void value_free(Value *val);
+int value_truthy(Value *val);
 void value_print(Value *val, FILE *output);
+void value_write(Value *val, ByteBuffer *buf);
 char* value_to_string(Value *val);
+Value value_concat(Arena *arena, Value *left, Value *right);
+Value value_binary_op(Arena *arena, BinaryOperator op, Value *left, Value *right);
+
+// Route response functions
+void route_response_init(RouteResponse *response);
+void route_response_reset(RouteResponse *response);
+void route_response_free(RouteResponse *response);
 
 #endif
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "diagnostic.h"
 
 // Token types for our web language
 typedef enum {
@@ -45,28 +46,42 @@ typedef enum {
     TOKEN_UNKNOWN
 } TokenType;
 
-// Token structure
+// Token structure. The value points into the TokenList's text. Characters
+// that start no token become one TOKEN_UNKNOWN (reported as an error), as
+// does an unterminated string, which then runs to the end of the source.
 typedef struct {
     TokenType type;
-    char *value;
+    char *value;      // NULL for EOF and unknown characters
     int line;
     int column;
 } Token;
 
-// Lexer structure
+// Lexer structure. Scans [source, end) with a cursor, so the source
+// doesn't have to be NUL-terminated and is never measured again.
 typedef struct {
     const char *source;
-    int position;
+    const char *end;
+    const char *cursor;
+    const char *line_start;  // Columns are counted from here, starting at 0
     int line;
-    int column;
-    char current_char;
+    char *text;              // Next free byte of the TokenList text being filled
+    DiagnosticList *diagnostics;  // Where errors go; NULL prints them to stderr
 } Lexer;
 
+// Every token of a source, EOF last, in one array, and their values in
+// one buffer
+typedef struct {
+    Token *tokens;
+    int count;
+    char *text;
+} TokenList;
+
 // Function prototypes
 Lexer* lexer_init(const char *source);
+Lexer* lexer_init_len(const char *source, size_t length);
 void lexer_free(Lexer *lexer);
-Token* lexer_next_token(Lexer *lexer);
-void token_free(Token *token);
+void lexer_tokenize(Lexer *lexer, TokenList *list);  // Rest of the source
+void token_list_free(TokenList *list);
 const char* token_type_to_string(TokenType type);
 void token_print(Token *token);
 
@@ -0,0 +1,21 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "ast.h"
+#include "image.h"
+
+// A program read from a file: WebBubble source (.bub), which is mapped,
+// parsed, optimized and resolved, or a precompiled image (.bubc, see
+// image.h), which is mapped as it is. Exactly one of ast and image is set.
+typedef struct {
+    ASTNode *ast;
+    ProgramImage *image;
+} LoadedProgram;
+
+// Returns 0 on success, -1 with a message on stderr if the file can't be
+// read or doesn't hold a valid program. Syntax errors are printed one per
+// line as "path:line:column: error: message".
+int program_load(const char *path, LoadedProgram *program);
+void program_unload(LoadedProgram *program);
+
+#endif
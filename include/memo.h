@@ -0,0 +1,67 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "arena.h"
+#include "interpreter.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Results of "memo function"s (see resolver.h for which functions qualify),
+// shared by every worker. The cache is split into shards, each with its own
+// lock, hash table and LRU list, so workers calling different functions or
+// arguments rarely contend; a full shard evicts its least recently used
+// entry. Keys and results are copied in, so the cache never points into a
+// request's arena.
+
+#define MEMO_SHARDS 16
+#define MEMO_DEFAULT_ENTRIES 4096
+
+// Function index and argument values, encoded into bytes. Built in a
+// request's arena for one call.
+struct MemoKey {
+    uint64_t hash;
+    size_t len;
+    unsigned char *bytes;
+};
+
+typedef struct MemoEntry MemoEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    MemoEntry **buckets;
+    size_t bucket_mask;
+    MemoEntry *newest;     // LRU list, most recently used first
+    MemoEntry *oldest;
+    size_t count;
+    size_t capacity;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} MemoShard;
+
+struct MemoCache {
+    MemoShard shards[MEMO_SHARDS];
+};
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t entries;
+} MemoStats;
+
+// capacity is the total number of entries, spread evenly over the shards
+MemoCache *memo_cache_create(size_t capacity);
+void memo_cache_free(MemoCache *cache);
+
+MemoKey *memo_key_create(Arena *arena, uint32_t function, const Value *args, int count);
+
+// On a hit, copy the cached result into *result (strings into arena) and
+// return 1. A miss returns 0; the caller runs the function and stores it.
+int memo_cache_lookup(MemoCache *cache, const MemoKey *key, Arena *arena, Value *result);
+void memo_cache_store(MemoCache *cache, const MemoKey *key, const Value *result);
+
+void memo_cache_stats(MemoCache *cache, MemoStats *stats);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ast.h"
+
+// Simplify each route's AST in place. Run after parsing and before the
+// resolver, since it may remove assignments.
+//
+//  - Folds operators whose operands are constant (numbers, and strings
+//    joined with '+'), and HTML blocks whose identifiers are all constant.
+//  - Propagates constants through locals assigned exactly once, from the
+//    top level of the route body, into every later read.
+//  - Replaces an if with a constant condition by the branch it takes, and
+//    drops a while whose condition is constantly false.
+//  - Removes assignments whose variable is never read.
+//
+// Routes whose body ends up as nothing but constant responses get
+// route.is_constant set.
+void optimize_program(ASTNode *program);
+
+#endif
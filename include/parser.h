@@ -4,15 +4,40 @@
 #include "lexer.h"
 #include "ast.h"
 
-// Parser structure
+// Growable list of nodes, for collecting children before they are copied
+// into the AST arena
+typedef struct {
+    ASTNode **items;
+    int count;
+    int capacity;
+} NodeList;
+
+// Deepest nesting of blocks, parentheses and calls, and tallest expression,
+// the parser accepts. The parser and every pass after it recurse over the
+// tree, so a deeper program could overflow their stacks.
+#define PARSER_MAX_DEPTH 256
+
+// Parser structure. The source is tokenized once, up front, and the parser
+// walks the array, so it can look any number of tokens ahead.
+//
+// Errors never end the process. The lexer reports every bad token; the
+// parser stops at its first error, since what follows can't be trusted.
 typedef struct {
     Lexer *lexer;
+    TokenList tokens;
+    int position;          // Index of current_token
     Token *current_token;
+    ASTArena *ast;         // Arena of the program being parsed
+    NodeList scratch;      // Children of the lists being parsed, innermost last
+    DiagnosticList diagnostics;  // Every lexer error, then the parser's first
+    int failed;            // A parse error has skipped to EOF
+    int depth;             // Nesting around the current token
+    int height;            // Of the expression last parsed
 } Parser;
 
 // Parser functions
 Parser* parser_init(Lexer *lexer);
 void parser_free(Parser *parser);
-ASTNode* parser_parse(Parser *parser);
+ASTNode* parser_parse(Parser *parser);  // NULL if parser->diagnostics has errors
 
 #endif
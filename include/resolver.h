@@ -0,0 +1,18 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "ast.h"
+
+// Assign every variable in each route and function a fixed slot in its
+// frame, filling in identifier/assignment slots and slot counts. A route's
+// path parameters take the first slots, in path order, and route.resolved
+// is set; a function's parameters take its first slots too. Names that are read but never bound keep slot -1 and are
+// looked up by name at runtime. Calls are bound to their function, and
+// each function gets its index in the program's function table.
+//
+// Functions are also checked for purity: no response, no names outside
+// their frame, and only calls to defined pure functions. A "memo"
+// function that fails the check loses its annotation, with a warning.
+void resolve_program(ASTNode *program);
+
+#endif
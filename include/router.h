@@ -0,0 +1,88 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "ast.h"
+#include "strview.h"
+#include <stdint.h>
+
+#define ROUTER_MAX_PARAMS 16
+
+// Methods a route can be bound to with "METHOD /path". Routes without a
+// method prefix are stored under ROUTER_METHOD_ANY and accept every method.
+// GET routes also answer HEAD requests, unless a HEAD route is defined.
+typedef enum {
+    ROUTER_METHOD_GET,
+    ROUTER_METHOD_HEAD,
+    ROUTER_METHOD_POST,
+    ROUTER_METHOD_PUT,
+    ROUTER_METHOD_DELETE,
+    ROUTER_METHOD_PATCH,
+    ROUTER_METHOD_OPTIONS,
+    ROUTER_METHOD_ANY,
+    ROUTER_METHOD_COUNT
+} RouterMethod;
+
+typedef enum {
+    ROUTER_NOT_FOUND,
+    ROUTER_MATCHED,
+    ROUTER_METHOD_NOT_ALLOWED  // Path exists; see RouteMatch.allowed
+} RouterResult;
+
+// Routes compiled into a trie keyed by path segment. The trie is stored as
+// flat arrays linked by index, with all text in one string pool, so it has
+// no internal pointers.
+typedef struct {
+    uint32_t label;        // Segment text (string pool offset); unused for params
+    uint32_t label_len;
+    uint32_t first_child;  // Static children are contiguous, sorted by label
+    uint32_t child_count;
+    int32_t param_child;   // Child matching any segment (":name"), or -1
+    int32_t routes[ROUTER_METHOD_COUNT];  // Route ending here per method, or -1
+    uint32_t methods;      // Bit per method with a route here
+} RouterNode;
+
+typedef struct {
+    uint32_t name;         // Parameter name (string pool offset, NUL-terminated)
+    uint32_t name_len;
+} RouterParam;
+
+typedef struct {
+    uint32_t first_param;  // Index into params
+    uint32_t param_count;
+} RouterRoute;
+
+typedef struct {
+    RouterNode *nodes;     // nodes[0] is the root ("/")
+    uint32_t node_count;
+    RouterRoute *routes;   // Indexed like program->data.program.routes
+    uint32_t route_count;
+    RouterParam *params;
+    uint32_t param_count;
+    char *strings;
+    uint32_t strings_len;
+} Router;
+
+typedef struct {
+    StrView name;
+    StrView value;         // Points into the request path
+} RouteParam;
+
+typedef struct {
+    int route;
+    int param_count;
+    RouteParam params[ROUTER_MAX_PARAMS];
+    uint32_t allowed;      // For ROUTER_METHOD_NOT_ALLOWED: bit per method, HEAD with GET
+} RouteMatch;
+
+Router* router_compile(ASTNode *program);
+RouterResult router_match(const Router *router, int method, const char *path, size_t path_len,
+                          RouteMatch *match);
+void router_free(Router *router);
+
+// Method helpers. router_parse_method returns -1 for methods routes cannot
+// be bound to; such requests only match routes without a method prefix.
+int router_parse_method(const char *name, size_t len);
+const char *router_method_name(int method);
+const char *router_split_method(const char *pattern, int *method);  // Returns the path part
+
+#endif
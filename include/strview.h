@@ -0,0 +1,35 @@
+#ifndef STRVIEW_H
+#define STRVIEW_H
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+// Non-owning view of a byte range (not NUL-terminated)
+typedef struct {
+    const char *data;
+    size_t len;
+} StrView;
+
+// View of a string literal, with its length computed at compile time
+#define STRVIEW_LITERAL(str) strview_make((str), sizeof(str) - 1)
+
+static inline StrView strview_make(const char *data, size_t len)
+{
+    StrView view = {data, len};
+    return view;
+}
+
+static inline int strview_equals(StrView view, const char *str)
+{
+    size_t len = strlen(str);
+    return view.len == len && memcmp(view.data, str, len) == 0;
+}
+
+static inline int strview_equals_nocase(StrView view, const char *str)
+{
+    size_t len = strlen(str);
+    return view.len == len && strncasecmp(view.data, str, len) == 0;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN_UP(n) (((n) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define BLOCK_HEADER ALIGN_UP(sizeof(ArenaBlock))
+
+void arena_init(Arena *arena, size_t block_size)
+{
+    arena->head = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+void arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+// Blocks past current are marked empty lazily as the arena reaches them,
+// so rewinding only has to touch the first one
+void arena_reset(Arena *arena)
+{
+    arena->current = arena->head;
+    if (arena->current)
+        arena->current->used = 0;
+}
+
+static ArenaBlock *block_create(size_t cap)
+{
+    ArenaBlock *block = (ArenaBlock *)malloc(BLOCK_HEADER + cap);
+    block->next = NULL;
+    block->cap = cap;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = ALIGN_UP(size ? size : 1);
+
+    ArenaBlock *block = arena->current;
+    if (block && block->cap - block->used >= size)
+    {
+        void *ptr = (char *)block + BLOCK_HEADER + block->used;
+        block->used += size;
+        return ptr;
+    }
+
+    // Move on to the next retained block if the allocation fits there,
+    // otherwise splice a new block in after the current one
+    ArenaBlock *next = block ? block->next : arena->head;
+    if (next && next->cap >= size)
+    {
+        next->used = 0;
+    }
+    else
+    {
+        next = block_create(size > arena->block_size ? size : arena->block_size);
+        if (block)
+        {
+            next->next = block->next;
+            block->next = next;
+        }
+        else
+        {
+            next->next = arena->head;
+            arena->head = next;
+        }
+    }
+
+    arena->current = next;
+    next->used = size;
+    return (char *)next + BLOCK_HEADER;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+    char *copy = (char *)arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *str)
+{
+    return arena_strndup(arena, str, strlen(str));
+}
@@ -3,180 +3,215 @@
 #include <string.h>
 #include <stdio.h>
 
-// Create program node
+// Large blocks: a big program's tree takes only a handful of mallocs
+#define AST_ARENA_BLOCK_SIZE (64 * 1024)
+
+static ASTNode *node_create(ASTArena *arena, ASTNodeType type)
+{
+    ASTNode *node = (ASTNode *)arena_alloc(&arena->nodes, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+// Copy a list into the arena, right after the nodes it holds
+static ASTNode **copy_nodes(ASTArena *arena, ASTNode **nodes, int count)
+{
+    if (count == 0)
+        return NULL;
+    ASTNode **copy = (ASTNode **)arena_alloc(&arena->nodes, sizeof(ASTNode *) * count);
+    memcpy(copy, nodes, sizeof(ASTNode *) * count);
+    return copy;
+}
+
+// Create program node, and the arena its tree lives in
 ASTNode *ast_create_program()
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_PROGRAM;
+    ASTArena *arena = (ASTArena *)malloc(sizeof(ASTArena));
+    arena_init(&arena->nodes, AST_ARENA_BLOCK_SIZE);
+    intern_init(&arena->strings, &arena->nodes);
+
+    ASTNode *node = node_create(arena, AST_PROGRAM);
     node->data.program.routes = NULL;
     node->data.program.route_count = 0;
+    node->data.program.functions = NULL;
+    node->data.program.function_count = 0;
+    node->data.program.arena = arena;
     return node;
 }
 
 // Create route node
-ASTNode *ast_create_route(char *path, ASTNode *body)
+ASTNode *ast_create_route(ASTArena *arena, const char *path, ASTNode *body)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_ROUTE;
-    node->data.route.path = strdup(path);
+    ASTNode *node = node_create(arena, AST_ROUTE);
+    node->data.route.path = intern_cstr(&arena->strings, path);
     node->data.route.body = body;
+    node->data.route.slot_count = 0;
+    node->data.route.resolved = 0;
+    node->data.route.is_constant = 0;
     return node;
 }
 
 // Create response node
-ASTNode *ast_create_response(ASTNode *value, int is_html)
+ASTNode *ast_create_response(ASTArena *arena, ASTNode *value, int is_html)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_RESPONSE;
+    ASTNode *node = node_create(arena, AST_RESPONSE);
     node->data.response.value = value;
     node->data.response.is_html = is_html;
     return node;
 }
 
 // Create assignment node
-ASTNode *ast_create_assignment(char *name, ASTNode *value)
+ASTNode *ast_create_assignment(ASTArena *arena, const char *name, ASTNode *value)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_ASSIGNMENT;
-    node->data.assignment.name = strdup(name);
+    ASTNode *node = node_create(arena, AST_ASSIGNMENT);
+    node->data.assignment.name = intern_cstr(&arena->strings, name);
     node->data.assignment.value = value;
+    node->data.assignment.slot = -1;
     return node;
 }
 
 // Create identifier node
-ASTNode *ast_create_identifier(char *name)
+ASTNode *ast_create_identifier(ASTArena *arena, const char *name)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_IDENTIFIER;
-    node->data.identifier.name = strdup(name);
+    ASTNode *node = node_create(arena, AST_IDENTIFIER);
+    node->data.identifier.name = intern_cstr(&arena->strings, name);
+    node->data.identifier.slot = -1;
     return node;
 }
 
 // Create string node
-ASTNode *ast_create_string(char *value)
+ASTNode *ast_create_string(ASTArena *arena, const char *value)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_STRING;
-    node->data.string.value = strdup(value);
+    ASTNode *node = node_create(arena, AST_STRING);
+    node->data.string.value = intern_cstr(&arena->strings, value);
     return node;
 }
 
 // Create number node
-ASTNode *ast_create_number(double value)
+ASTNode *ast_create_number(ASTArena *arena, double value)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_NUMBER;
+    ASTNode *node = node_create(arena, AST_NUMBER);
     node->data.number.value = value;
     return node;
 }
 
 // Create block node
-ASTNode *ast_create_block()
+ASTNode *ast_create_block(ASTArena *arena, ASTNode **statements, int statement_count)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_BLOCK;
-    node->data.block.statements = NULL;
-    node->data.block.statement_count = 0;
+    ASTNode *node = node_create(arena, AST_BLOCK);
+    node->data.block.statements = copy_nodes(arena, statements, statement_count);
+    node->data.block.statement_count = statement_count;
     return node;
 }
 
 // Create binary operation node
-ASTNode *ast_create_binary_op(const char *operator, ASTNode *left, ASTNode *right)
+ASTNode *ast_create_binary_op(ASTArena *arena, BinaryOperator op, ASTNode *left, ASTNode *right)
 {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = AST_BINARY_OP;
-    node->data.binary_op.operator = strdup(operator);
+    ASTNode *node = node_create(arena, AST_BINARY_OP);
+    node->data.binary_op.op = op;
     node->data.binary_op.left = left;
     node->data.binary_op.right = right;
     return node;
 }
 
-// Add route to program
-void ast_program_add_route(ASTNode *program, ASTNode *route)
+// Create if node; else_branch is a block, another if (else if) or NULL
+ASTNode *ast_create_if(ASTArena *arena, ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch)
 {
-    if (program->type != AST_PROGRAM)
-        return;
-
-    int count = program->data.program.route_count;
-    program->data.program.routes = (ASTNode **)realloc(
-        program->data.program.routes,
-        sizeof(ASTNode *) * (count + 1));
-    program->data.program.routes[count] = route;
-    program->data.program.route_count++;
+    ASTNode *node = node_create(arena, AST_IF);
+    node->data.if_stmt.condition = condition;
+    node->data.if_stmt.then_branch = then_branch;
+    node->data.if_stmt.else_branch = else_branch;
+    return node;
 }
 
-// Add statement to block
-void ast_block_add_statement(ASTNode *block, ASTNode *statement)
+// Create while node
+ASTNode *ast_create_while(ASTArena *arena, ASTNode *condition, ASTNode *body)
 {
-    if (block->type != AST_BLOCK)
-        return;
-
-    int count = block->data.block.statement_count;
-    block->data.block.statements = (ASTNode **)realloc(
-        block->data.block.statements,
-        sizeof(ASTNode *) * (count + 1));
-    block->data.block.statements[count] = statement;
-    block->data.block.statement_count++;
+    ASTNode *node = node_create(arena, AST_WHILE);
+    node->data.while_stmt.condition = condition;
+    node->data.while_stmt.body = body;
+    return node;
 }
 
-// Free AST node and all children
-void ast_free(ASTNode *node)
+// Create function node
+ASTNode *ast_create_function(ASTArena *arena, const char *name, const char **params, int param_count,
+                             ASTNode *body)
 {
-    if (!node)
-        return;
-
-    switch (node->type)
+    ASTNode *node = node_create(arena, AST_FUNCTION);
+    node->data.function.name = intern_cstr(&arena->strings, name);
+    node->data.function.params = NULL;
+    if (param_count > 0)
+        node->data.function.params = (char **)arena_alloc(&arena->nodes, sizeof(char *) * param_count);
+    for (int i = 0; i < param_count; i++)
     {
-    case AST_PROGRAM:
-        for (int i = 0; i < node->data.program.route_count; i++)
-        {
-            ast_free(node->data.program.routes[i]);
-        }
-        free(node->data.program.routes);
-        break;
-
-    case AST_ROUTE:
-        free(node->data.route.path);
-        ast_free(node->data.route.body);
-        break;
+        node->data.function.params[i] = intern_cstr(&arena->strings, params[i]);
+    }
+    node->data.function.param_count = param_count;
+    node->data.function.body = body;
+    node->data.function.slot_count = 0;
+    node->data.function.index = -1;
+    node->data.function.memo = 0;
+    node->data.function.pure = 0;
+    return node;
+}
 
-    case AST_RESPONSE:
-        ast_free(node->data.response.value);
-        break;
+// Create function call node
+ASTNode *ast_create_function_call(ASTArena *arena, const char *name, ASTNode **args, int arg_count)
+{
+    ASTNode *node = node_create(arena, AST_FUNCTION_CALL);
+    node->data.function_call.name = intern_cstr(&arena->strings, name);
+    node->data.function_call.args = copy_nodes(arena, args, arg_count);
+    node->data.function_call.arg_count = arg_count;
+    node->data.function_call.target = NULL;
+    return node;
+}
 
-    case AST_ASSIGNMENT:
-        free(node->data.assignment.name);
-        ast_free(node->data.assignment.value);
-        break;
+// Create return node; value may be NULL
+ASTNode *ast_create_return(ASTArena *arena, ASTNode *value)
+{
+    ASTNode *node = node_create(arena, AST_RETURN);
+    node->data.return_stmt.value = value;
+    return node;
+}
 
-    case AST_IDENTIFIER:
-        free(node->data.identifier.name);
-        break;
+const char *binary_operator_symbol(BinaryOperator op)
+{
+    static const char *symbols[] = {"+", "-", "*", "/", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    return op < BINOP_UNKNOWN ? symbols[op] : "?";
+}
 
-    case AST_STRING:
-        free(node->data.string.value);
-        break;
+// Set the program's routes
+void ast_program_set_routes(ASTNode *program, ASTNode **routes, int count)
+{
+    program->data.program.routes = copy_nodes(program->data.program.arena, routes, count);
+    program->data.program.route_count = count;
+}
 
-    case AST_BLOCK:
-        for (int i = 0; i < node->data.block.statement_count; i++)
-        {
-            ast_free(node->data.block.statements[i]);
-        }
-        free(node->data.block.statements);
-        break;
+// Set the program's function table
+void ast_program_set_functions(ASTNode *program, ASTNode **functions, int count)
+{
+    program->data.program.functions = copy_nodes(program->data.program.arena, functions, count);
+    program->data.program.function_count = count;
+}
 
-    case AST_BINARY_OP:
-        free(node->data.binary_op.operator);
-        ast_free(node->data.binary_op.left);
-        ast_free(node->data.binary_op.right);
-        break;
+// Replace a block's statements. The old list stays in the arena until
+// the tree is freed.
+void ast_block_set_statements(ASTArena *arena, ASTNode *block, ASTNode **statements, int count)
+{
+    block->data.block.statements = copy_nodes(arena, statements, count);
+    block->data.block.statement_count = count;
+}
 
-    case AST_NUMBER:
-        // Nothing to free
-        break;
-    }
+// Free a program's tree: every node and string is in its arena
+void ast_free(ASTNode *program)
+{
+    if (!program || program->type != AST_PROGRAM)
+        return;
 
-    free(node);
+    ASTArena *arena = program->data.program.arena;
+    intern_free(&arena->strings);
+    arena_free(&arena->nodes);
+    free(arena);
 }
 
 // Print AST (for debugging)
@@ -191,7 +226,12 @@ void ast_print(ASTNode *node, int indent)
     switch (node->type)
     {
     case AST_PROGRAM:
-        printf("Program (%d routes)\n", node->data.program.route_count);
+        printf("Program (%d routes, %d functions)\n", node->data.program.route_count,
+               node->data.program.function_count);
+        for (int i = 0; i < node->data.program.function_count; i++)
+        {
+            ast_print(node->data.program.functions[i], indent + 1);
+        }
         for (int i = 0; i < node->data.program.route_count; i++)
         {
             ast_print(node->data.program.routes[i], indent + 1);
@@ -234,9 +274,53 @@ void ast_print(ASTNode *node, int indent)
         break;
 
     case AST_BINARY_OP:
-        printf("BinaryOp: %s\n", node->data.binary_op.operator);
+        printf("BinaryOp: %s\n", binary_operator_symbol(node->data.binary_op.op));
         ast_print(node->data.binary_op.left, indent + 1);
         ast_print(node->data.binary_op.right, indent + 1);
         break;
+
+    case AST_IF:
+        printf("If\n");
+        ast_print(node->data.if_stmt.condition, indent + 1);
+        ast_print(node->data.if_stmt.then_branch, indent + 1);
+        if (node->data.if_stmt.else_branch)
+        {
+            for (int i = 0; i < indent; i++)
+                printf("  ");
+            printf("Else\n");
+            ast_print(node->data.if_stmt.else_branch, indent + 1);
+        }
+        break;
+
+    case AST_WHILE:
+        printf("While\n");
+        ast_print(node->data.while_stmt.condition, indent + 1);
+        ast_print(node->data.while_stmt.body, indent + 1);
+        break;
+
+    case AST_FUNCTION:
+        printf("Function: %s%s(", node->data.function.memo ? "memo " : "",
+               node->data.function.name);
+        for (int i = 0; i < node->data.function.param_count; i++)
+        {
+            printf("%s%s", i ? ", " : "", node->data.function.params[i]);
+        }
+        printf(")\n");
+        ast_print(node->data.function.body, indent + 1);
+        break;
+
+    case AST_FUNCTION_CALL:
+        printf("Call: %s (%d args)\n", node->data.function_call.name,
+               node->data.function_call.arg_count);
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            ast_print(node->data.function_call.args[i], indent + 1);
+        }
+        break;
+
+    case AST_RETURN:
+        printf("Return\n");
+        ast_print(node->data.return_stmt.value, indent + 1);
+        break;
     }
 }
@@ -0,0 +1,73 @@
+#include "bytebuffer.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTEBUFFER_MIN_CAP 256
+
+void bytebuffer_init(ByteBuffer *buf)
+{
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void bytebuffer_free(ByteBuffer *buf)
+{
+    free(buf->data);
+    bytebuffer_init(buf);
+}
+
+void bytebuffer_reset(ByteBuffer *buf)
+{
+    buf->len = 0;
+}
+
+char *bytebuffer_reserve(ByteBuffer *buf, size_t extra)
+{
+    if (buf->len + extra > buf->cap)
+    {
+        size_t cap = buf->cap ? buf->cap : BYTEBUFFER_MIN_CAP;
+        while (cap < buf->len + extra)
+            cap *= 2;
+        buf->data = (char *)realloc(buf->data, cap);
+        buf->cap = cap;
+    }
+    return buf->data + buf->len;
+}
+
+void bytebuffer_append(ByteBuffer *buf, const void *data, size_t len)
+{
+    if (len == 0)
+        return;
+    memcpy(bytebuffer_reserve(buf, len), data, len);
+    buf->len += len;
+}
+
+void bytebuffer_append_str(ByteBuffer *buf, const char *str)
+{
+    bytebuffer_append(buf, str, strlen(str));
+}
+
+void bytebuffer_appendf(ByteBuffer *buf, const char *format, ...)
+{
+    va_list args;
+    char *dest = bytebuffer_reserve(buf, 64);
+    size_t available = buf->cap - buf->len;
+
+    va_start(args, format);
+    int needed = vsnprintf(dest, available, format, args);
+    va_end(args);
+    if (needed < 0)
+        return;
+
+    if ((size_t)needed >= available)
+    {
+        dest = bytebuffer_reserve(buf, (size_t)needed + 1);
+        va_start(args, format);
+        vsnprintf(dest, (size_t)needed + 1, format, args);
+        va_end(args);
+    }
+    buf->len += (size_t)needed;
+}
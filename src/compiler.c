@@ -0,0 +1,599 @@
+#include "bytecode.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    BytecodeProgram *program;
+    uint32_t code_cap;
+    uint32_t number_cap;
+    uint32_t string_cap;
+    uint32_t pool_cap;
+    uint32_t depth;        // Operand stack depth at this point in the body
+    int in_function;       // Compiling a function body, where tail calls apply
+    uint32_t max_depth;
+    int failed;
+
+    // String constant of each AST string already added. AST strings are
+    // interned, so the pointer identifies the text.
+    const char **string_keys;
+    uint32_t *string_ids;
+    uint32_t string_slots; // Power of two, kept at most half full
+} Compiler;
+
+#define GROW(ptr, count, cap, type)                                 \
+    do                                                              \
+    {                                                               \
+        if ((count) == (cap))                                       \
+        {                                                           \
+            (cap) = (cap) ? (cap) * 2 : 64;                         \
+            (ptr) = (type *)realloc((ptr), sizeof(type) * (cap));   \
+        }                                                           \
+    } while (0)
+
+// ===== STACK EFFECTS =====
+
+void bytecode_stack_effect(Instruction ins, const BytecodeFunction *functions,
+                           uint32_t *pops, uint32_t *pushes)
+{
+    *pops = 0;
+    *pushes = 0;
+    switch (INSTR_OP(ins))
+    {
+    case OP_PUSH_STRING:
+    case OP_PUSH_NUMBER:
+    case OP_PUSH_NULL:
+    case OP_PUSH_BOOL:
+    case OP_LOAD:
+    case OP_LOAD_NAME:
+    case OP_CALL_MISSING:
+        *pushes = 1;
+        break;
+    case OP_POP:
+    case OP_STORE:
+    case OP_STORE_NAME:
+    case OP_RESPOND:
+    case OP_RESPOND_HTML:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_RETURN:
+        *pops = 1;
+        break;
+    case OP_APPEND_NAME:
+        *pops = 1;
+        *pushes = 1;
+        break;
+    case OP_CONCAT:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_LT:
+    case OP_GT:
+    case OP_LTE:
+    case OP_GTE:
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_BINARY:
+        *pops = 2;
+        *pushes = 1;
+        break;
+    case OP_CALL:
+    case OP_CALL_MEMO:
+        *pops = functions[INSTR_ARG(ins)].param_count;
+        *pushes = 1;
+        break;
+    case OP_TAILCALL:
+        *pops = functions[INSTR_ARG(ins)].param_count;
+        break;
+    default:
+        // OP_JUMP and OP_HALT
+        break;
+    }
+}
+
+// ===== EMITTER =====
+
+// Append an instruction and track the operand stack depth after it
+static void emit(Compiler *c, Opcode op, uint32_t arg)
+{
+    BytecodeProgram *program = c->program;
+    if (arg > INSTR_MAX_ARG)
+    {
+        fprintf(stderr, "Bytecode error: operand %u out of range\n", arg);
+        c->failed = 1;
+        arg = 0;
+    }
+
+    GROW(program->code, program->code_len, c->code_cap, Instruction);
+    program->code[program->code_len++] = INSTR(op, arg);
+
+    uint32_t pops, pushes;
+    bytecode_stack_effect(INSTR(op, arg), program->functions, &pops, &pushes);
+    c->depth += pushes - pops;
+    if (c->depth > c->max_depth)
+        c->max_depth = c->depth;
+}
+
+// Emit a jump whose target is filled in later by patch_jump
+static uint32_t emit_jump(Compiler *c, Opcode op)
+{
+    emit(c, op, 0);
+    return c->program->code_len - 1;
+}
+
+// Point the jump at index to the next instruction to be emitted
+static void patch_jump(Compiler *c, uint32_t at)
+{
+    uint32_t offset = c->program->code_len - (at + 1);
+    if (offset > INSTR_MAX_JUMP)
+    {
+        fprintf(stderr, "Bytecode error: jump of %u instructions out of range\n", offset);
+        c->failed = 1;
+        offset = 0;
+    }
+    c->program->code[at] = INSTR(INSTR_OP(c->program->code[at]), offset);
+}
+
+// Emit a jump back to target, the start of a loop
+static void emit_loop(Compiler *c, uint32_t target)
+{
+    uint32_t distance = c->program->code_len + 1 - target;
+    if (distance > INSTR_MAX_JUMP + 1)
+    {
+        fprintf(stderr, "Bytecode error: jump of %u instructions out of range\n", distance);
+        c->failed = 1;
+        distance = 0;
+    }
+    BytecodeProgram *program = c->program;
+    GROW(program->code, program->code_len, c->code_cap, Instruction);
+    program->code[program->code_len++] = INSTR(OP_JUMP, -(int32_t)distance);
+}
+
+static uint32_t add_number(Compiler *c, double value)
+{
+    BytecodeProgram *program = c->program;
+    GROW(program->numbers, program->number_count, c->number_cap, double);
+    program->numbers[program->number_count] = value;
+    return program->number_count++;
+}
+
+static void grow_string_index(Compiler *c)
+{
+    uint32_t slots = c->string_slots ? c->string_slots * 2 : 256;
+    const char **keys = (const char **)calloc(slots, sizeof(char *));
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * slots);
+
+    for (uint32_t i = 0; i < c->string_slots; i++)
+    {
+        if (!c->string_keys[i])
+            continue;
+        uint32_t j = (uint32_t)((uintptr_t)c->string_keys[i] >> 4) & (slots - 1);
+        while (keys[j])
+            j = (j + 1) & (slots - 1);
+        keys[j] = c->string_keys[i];
+        ids[j] = c->string_ids[i];
+    }
+
+    free(c->string_keys);
+    free(c->string_ids);
+    c->string_keys = keys;
+    c->string_ids = ids;
+    c->string_slots = slots;
+}
+
+// Add an AST string to the constants, or find the one already added
+static uint32_t add_string(Compiler *c, const char *str)
+{
+    BytecodeProgram *program = c->program;
+    if ((program->string_count + 1) * 2 > c->string_slots)
+        grow_string_index(c);
+
+    uint32_t mask = c->string_slots - 1;
+    uint32_t slot = (uint32_t)((uintptr_t)str >> 4) & mask;
+    while (c->string_keys[slot])
+    {
+        if (c->string_keys[slot] == str)
+            return c->string_ids[slot];
+        slot = (slot + 1) & mask;
+    }
+    c->string_keys[slot] = str;
+    c->string_ids[slot] = program->string_count;
+
+    size_t len = strlen(str) + 1;
+
+    while (program->pool_len + len > c->pool_cap)
+    {
+        c->pool_cap = c->pool_cap ? c->pool_cap * 2 : 256;
+        program->pool = (char *)realloc(program->pool, c->pool_cap);
+    }
+    memcpy(program->pool + program->pool_len, str, len);
+
+    GROW(program->strings, program->string_count, c->string_cap, uint32_t);
+    program->strings[program->string_count] = program->pool_len;
+    program->pool_len += len;
+    return program->string_count++;
+}
+
+// ===== COMPILATION =====
+
+static Opcode binary_opcode(BinaryOperator op)
+{
+    switch (op)
+    {
+    case BINOP_ADD: return OP_ADD;
+    case BINOP_SUB: return OP_SUB;
+    case BINOP_MUL: return OP_MUL;
+    case BINOP_DIV: return OP_DIV;
+    case BINOP_LT: return OP_LT;
+    case BINOP_GT: return OP_GT;
+    case BINOP_LTE: return OP_LTE;
+    case BINOP_GTE: return OP_GTE;
+    case BINOP_EQ: return OP_EQ;
+    case BINOP_NEQ: return OP_NEQ;
+    default: return OP_BINARY;
+    }
+}
+
+static void compile_expression(Compiler *c, ASTNode *node);
+
+// "a && b" and "a || b" evaluate to a bool and only run b when a doesn't
+// decide the result
+static void compile_logical(Compiler *c, ASTNode *node)
+{
+    int is_or = node->data.binary_op.op == BINOP_OR;
+    Opcode decides = is_or ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+
+    compile_expression(c, node->data.binary_op.left);
+    uint32_t left_decides = emit_jump(c, decides);
+    compile_expression(c, node->data.binary_op.right);
+    uint32_t right_decides = emit_jump(c, decides);
+
+    emit(c, OP_PUSH_BOOL, !is_or);
+    uint32_t done = emit_jump(c, OP_JUMP);
+    c->depth--; // Only one of the two pushes runs
+    patch_jump(c, left_decides);
+    patch_jump(c, right_decides);
+    emit(c, OP_PUSH_BOOL, is_or);
+    patch_jump(c, done);
+}
+
+// Arguments are padded with nulls or trimmed so the callee always finds
+// exactly its parameters on the stack. A tail call replaces the current
+// function, so it leaves nothing behind.
+static void compile_call(Compiler *c, ASTNode *node, int tail)
+{
+    ASTNode *target = node->data.function_call.target;
+    if (!target)
+    {
+        emit(c, OP_CALL_MISSING, add_string(c, node->data.function_call.name));
+        return;
+    }
+
+    int param_count = target->data.function.param_count;
+    for (int i = 0; i < node->data.function_call.arg_count; i++)
+    {
+        compile_expression(c, node->data.function_call.args[i]);
+        if (i >= param_count)
+            emit(c, OP_POP, 0);
+    }
+    for (int i = node->data.function_call.arg_count; i < param_count; i++)
+    {
+        emit(c, OP_PUSH_NULL, 0);
+    }
+    // A memo function is never tail-called: it needs a call of its own,
+    // whose return caches the result
+    if (target->data.function.memo)
+    {
+        emit(c, OP_CALL_MEMO, (uint32_t)target->data.function.index);
+        if (tail)
+            emit(c, OP_RETURN, 0);
+    }
+    else if (tail)
+        emit(c, OP_TAILCALL, (uint32_t)target->data.function.index);
+    else
+        emit(c, OP_CALL, (uint32_t)target->data.function.index);
+}
+
+static void compile_expression(Compiler *c, ASTNode *node)
+{
+    switch (node->type)
+    {
+    case AST_STRING:
+        emit(c, OP_PUSH_STRING, add_string(c, node->data.string.value));
+        break;
+
+    case AST_NUMBER:
+        emit(c, OP_PUSH_NUMBER, add_number(c, node->data.number.value));
+        break;
+
+    case AST_IDENTIFIER:
+        if (node->data.identifier.slot >= 0)
+            emit(c, OP_LOAD, (uint32_t)node->data.identifier.slot);
+        else
+            emit(c, OP_LOAD_NAME, add_string(c, node->data.identifier.name));
+        break;
+
+    case AST_BLOCK:
+        // HTML block: the text of each identifier, concatenated
+        emit(c, OP_PUSH_STRING, add_string(c, ""));
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *stmt = node->data.block.statements[i];
+            if (stmt->type != AST_IDENTIFIER)
+                continue;
+            if (stmt->data.identifier.slot >= 0)
+            {
+                emit(c, OP_LOAD, (uint32_t)stmt->data.identifier.slot);
+                emit(c, OP_CONCAT, 0);
+            }
+            else
+            {
+                emit(c, OP_APPEND_NAME, add_string(c, stmt->data.identifier.name));
+            }
+        }
+        break;
+
+    case AST_FUNCTION_CALL:
+        compile_call(c, node, 0);
+        break;
+
+    case AST_BINARY_OP:
+    {
+        BinaryOperator op = node->data.binary_op.op;
+        if (op == BINOP_AND || op == BINOP_OR)
+        {
+            compile_logical(c, node);
+            break;
+        }
+        compile_expression(c, node->data.binary_op.left);
+        compile_expression(c, node->data.binary_op.right);
+        Opcode opcode = binary_opcode(op);
+        emit(c, opcode, opcode == OP_BINARY ? (uint32_t)op : 0);
+        break;
+    }
+
+    default:
+        emit(c, OP_PUSH_NULL, 0);
+        break;
+    }
+}
+
+static void compile_statement(Compiler *c, ASTNode *node)
+{
+    switch (node->type)
+    {
+    case AST_ASSIGNMENT:
+        compile_expression(c, node->data.assignment.value);
+        if (node->data.assignment.slot >= 0)
+            emit(c, OP_STORE, (uint32_t)node->data.assignment.slot);
+        else
+            emit(c, OP_STORE_NAME, add_string(c, node->data.assignment.name));
+        break;
+
+    case AST_RESPONSE:
+        compile_expression(c, node->data.response.value);
+        emit(c, node->data.response.is_html ? OP_RESPOND_HTML : OP_RESPOND, 0);
+        break;
+
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            compile_statement(c, node->data.block.statements[i]);
+        }
+        break;
+
+    case AST_IF:
+    {
+        compile_expression(c, node->data.if_stmt.condition);
+        uint32_t skip_then = emit_jump(c, OP_JUMP_IF_FALSE);
+        compile_statement(c, node->data.if_stmt.then_branch);
+        if (node->data.if_stmt.else_branch)
+        {
+            uint32_t skip_else = emit_jump(c, OP_JUMP);
+            patch_jump(c, skip_then);
+            compile_statement(c, node->data.if_stmt.else_branch);
+            patch_jump(c, skip_else);
+        }
+        else
+        {
+            patch_jump(c, skip_then);
+        }
+        break;
+    }
+
+    case AST_WHILE:
+    {
+        uint32_t start = c->program->code_len;
+        compile_expression(c, node->data.while_stmt.condition);
+        uint32_t exit = emit_jump(c, OP_JUMP_IF_FALSE);
+        compile_statement(c, node->data.while_stmt.body);
+        emit_loop(c, start);
+        patch_jump(c, exit);
+        break;
+    }
+
+    case AST_RETURN:
+    {
+        ASTNode *value = node->data.return_stmt.value;
+        if (c->in_function && value && value->type == AST_FUNCTION_CALL &&
+            value->data.function_call.target)
+        {
+            compile_call(c, value, 1);
+            break;
+        }
+        if (value)
+            compile_expression(c, value);
+        else
+            emit(c, OP_PUSH_NULL, 0);
+        emit(c, OP_RETURN, 0);
+        break;
+    }
+
+    case AST_FUNCTION_CALL:
+        compile_call(c, node, 0);
+        emit(c, OP_POP, 0);
+        break;
+
+    default:
+        // Bare identifiers and unsupported statements do nothing, as in
+        // the tree-walker
+        break;
+    }
+}
+
+BytecodeProgram *bytecode_compile(ASTNode *program)
+{
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.program = (BytecodeProgram *)calloc(1, sizeof(BytecodeProgram));
+
+    int route_count = program->data.program.route_count;
+    c.program->route_count = route_count;
+    c.program->routes = (BytecodeRoute *)calloc(route_count > 0 ? route_count : 1,
+                                                 sizeof(BytecodeRoute));
+
+    int function_count = program->data.program.function_count;
+    c.program->function_count = function_count;
+    c.program->functions = (BytecodeFunction *)calloc(function_count > 0 ? function_count : 1,
+                                                       sizeof(BytecodeFunction));
+
+    // A call's stack effect depends on its callee's parameter count, and
+    // the callee may not be compiled yet
+    for (int i = 0; i < function_count; i++)
+    {
+        c.program->functions[i].param_count =
+            (uint32_t)program->data.program.functions[i]->data.function.param_count;
+    }
+
+    for (int i = 0; i < function_count; i++)
+    {
+        ASTNode *function = program->data.program.functions[i];
+        BytecodeFunction *compiled = &c.program->functions[i];
+
+        c.depth = 0;
+        c.max_depth = 0;
+        c.in_function = 1;
+        compiled->code_start = c.program->code_len;
+        compile_statement(&c, function->data.function.body);
+        emit(&c, OP_PUSH_NULL, 0); // Falling off the end returns null
+        emit(&c, OP_RETURN, 0);
+        compiled->code_len = c.program->code_len - compiled->code_start;
+        compiled->name = add_string(&c, function->data.function.name);
+        compiled->slot_count = (uint32_t)function->data.function.slot_count;
+        compiled->max_stack = c.max_depth;
+        compiled->memo = (uint32_t)function->data.function.memo;
+    }
+
+    for (int i = 0; i < route_count; i++)
+    {
+        ASTNode *route = program->data.program.routes[i];
+        BytecodeRoute *compiled = &c.program->routes[i];
+
+        c.depth = 0;
+        c.max_depth = 0;
+        c.in_function = 0;
+        compiled->code_start = c.program->code_len;
+        compile_statement(&c, route->data.route.body);
+        emit(&c, OP_HALT, 0);
+        compiled->code_len = c.program->code_len - compiled->code_start;
+        compiled->slot_count = (uint32_t)route->data.route.slot_count;
+        compiled->max_stack = c.max_depth;
+        compiled->path = add_string(&c, route->data.route.path);
+        compiled->resolved = (uint32_t)route->data.route.resolved;
+        compiled->is_constant = (uint32_t)route->data.route.is_constant;
+    }
+
+    free(c.string_keys);
+    free(c.string_ids);
+    if (c.failed)
+    {
+        bytecode_free(c.program);
+        return NULL;
+    }
+    return c.program;
+}
+
+void bytecode_free(BytecodeProgram *program)
+{
+    if (!program)
+        return;
+    free(program->code);
+    free(program->numbers);
+    free(program->strings);
+    free(program->pool);
+    free(program->routes);
+    free(program->functions);
+    free(program);
+}
+
+// ===== DISASSEMBLY =====
+
+static const char *opcode_names[OP_COUNT] = {
+#define BYTECODE_NAME(op) #op,
+    BYTECODE_OPS(BYTECODE_NAME)
+#undef BYTECODE_NAME
+};
+
+static void disassemble_body(const BytecodeProgram *program, uint32_t start, uint32_t len, FILE *out)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        Instruction ins = program->code[start + i];
+        uint32_t arg = INSTR_ARG(ins);
+        fprintf(out, "  %4u  %-16s", i, opcode_names[INSTR_OP(ins)]);
+
+        switch (INSTR_OP(ins))
+        {
+        case OP_PUSH_STRING:
+        case OP_LOAD_NAME:
+        case OP_STORE_NAME:
+        case OP_APPEND_NAME:
+        case OP_CALL_MISSING:
+            fprintf(out, " \"%s\"", program->pool + program->strings[arg]);
+            break;
+        case OP_PUSH_NUMBER:
+            fprintf(out, " %g", program->numbers[arg]);
+            break;
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_BINARY:
+        case OP_PUSH_BOOL:
+            fprintf(out, " %u", arg);
+            break;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            fprintf(out, " -> %d", (int32_t)i + 1 + INSTR_SARG(ins));
+            break;
+        case OP_CALL:
+        case OP_CALL_MEMO:
+        case OP_TAILCALL:
+            fprintf(out, " %s", program->pool + program->strings[program->functions[arg].name]);
+            break;
+        default:
+            break;
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void bytecode_disassemble(const BytecodeProgram *program, FILE *out)
+{
+    for (uint32_t f = 0; f < program->function_count; f++)
+    {
+        const BytecodeFunction *function = &program->functions[f];
+        fprintf(out, "function %s (%u params, %u slots, stack %u)\n",
+                program->pool + program->strings[function->name], function->param_count,
+                function->slot_count, function->max_stack);
+        disassemble_body(program, function->code_start, function->code_len, out);
+    }
+
+    for (uint32_t r = 0; r < program->route_count; r++)
+    {
+        const BytecodeRoute *route = &program->routes[r];
+        fprintf(out, "route %u \"%s\" (%u slots, stack %u%s)\n", r,
+                program->pool + program->strings[route->path], route->slot_count,
+                route->max_stack, route->is_constant ? ", constant" : "");
+        disassemble_body(program, route->code_start, route->code_len, out);
+    }
+}
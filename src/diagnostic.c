@@ -0,0 +1,43 @@
+#include "diagnostic.h"
+#include <stdarg.h>
+#include <stdlib.h>
+
+void diagnostics_init(DiagnosticList *list)
+{
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void diagnostics_free(DiagnosticList *list)
+{
+    free(list->items);
+    diagnostics_init(list);
+}
+
+void diagnostics_add(DiagnosticList *list, int line, int column, const char *format, ...)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->items = (Diagnostic *)realloc(list->items, sizeof(Diagnostic) * list->capacity);
+    }
+
+    Diagnostic *diagnostic = &list->items[list->count++];
+    diagnostic->line = line;
+    diagnostic->column = column;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(diagnostic->message, sizeof(diagnostic->message), format, args);
+    va_end(args);
+}
+
+void diagnostics_print(const DiagnosticList *list, const char *name, FILE *output)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        const Diagnostic *diagnostic = &list->items[i];
+        fprintf(output, "%s:%d:%d: error: %s\n", name, diagnostic->line, diagnostic->column,
+                diagnostic->message);
+    }
+}
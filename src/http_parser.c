@@ -0,0 +1,709 @@
+#include "http_parser.h"
+#include <string.h>
+
+// Parser states
+enum
+{
+    PARSE_HEAD,        // Waiting for the blank line ending the headers
+    PARSE_BODY,        // Waiting for Content-Length bytes
+    PARSE_CHUNK_SIZE,  // Waiting for a "<hex>[;ext]\r\n" chunk header
+    PARSE_CHUNK_DATA,  // Copying chunk data
+    PARSE_CHUNK_CRLF,  // Waiting for the CRLF after chunk data
+    PARSE_TRAILERS,    // Skipping trailer lines after the last chunk
+    PARSE_DONE
+};
+
+// RFC 7230 tchar: characters allowed in methods and header names
+static const unsigned char token_chars[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1,
+    ['*'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1,
+    ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+    ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1,
+    ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1,
+    ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, ['U'] = 1,
+    ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1,
+    ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1,
+    ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, ['u'] = 1,
+    ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1,
+};
+
+static int is_token_char(char c)
+{
+    return token_chars[(unsigned char)c];
+}
+
+// Control characters are not allowed in header values (HTAB is)
+static int is_value_char(char c)
+{
+    unsigned char u = (unsigned char)c;
+    return u >= 0x20 ? u != 0x7f : u == '\t';
+}
+
+// ===== DELIMITER SCANNING =====
+//
+// Header names and values are scanned for their terminating byte (':' after
+// a name, CR/LF after a value) while validating every byte on the way. For
+// small API requests this is the hottest loop in the server, so there are
+// SSE4.2 and AVX2 versions selected at startup by CPU feature detection.
+// All versions return the first byte in [p, end) failing the check and never
+// read past end.
+
+typedef const char *(*ScanFn)(const char *p, const char *end);
+
+static const char *scan_token_scalar(const char *p, const char *end)
+{
+    while (p < end && is_token_char(*p))
+        p++;
+    return p;
+}
+
+static const char *scan_value_scalar(const char *p, const char *end)
+{
+    while (p < end && is_value_char(*p))
+        p++;
+    return p;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_PARSER_X86 1
+#include <immintrin.h>
+
+// Byte ranges (inclusive pairs) that end a token. '*' and '+' are tchars
+// but share a range with '(' ')' ',' to fit the 8-range limit of
+// PCMPESTRI; the scalar check after a hit skips over them.
+static const char token_stop_ranges[16] __attribute__((aligned(16))) =
+    "\x00\x20\"\"(,//:@[]{{}\xff";
+
+// Control characters other than HTAB, and DEL, end a header value
+static const char value_stop_ranges[16] __attribute__((aligned(16))) =
+    "\x00\x08\x0a\x1f\x7f\x7f";
+
+// Always inlined so the AVX2 scanners get a VEX-encoded copy for their tails
+// (mixing legacy SSE and AVX code costs a state transition on each call)
+__attribute__((target("sse4.2"), always_inline))
+static inline const char *scan_token_sse42_impl(const char *p, const char *end)
+{
+    __m128i ranges = _mm_load_si128((const __m128i *)token_stop_ranges);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int index = _mm_cmpestri(ranges, 16, chunk, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index == 16)
+        {
+            p += 16;
+            continue;
+        }
+        p += index;
+        if (!is_token_char(*p))
+            return p;
+        p++;
+    }
+    return scan_token_scalar(p, end);
+}
+
+__attribute__((target("sse4.2"), always_inline))
+static inline const char *scan_value_sse42_impl(const char *p, const char *end)
+{
+    __m128i ranges = _mm_load_si128((const __m128i *)value_stop_ranges);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int index = _mm_cmpestri(ranges, 6, chunk, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index != 16)
+            return p + index;
+        p += 16;
+    }
+    return scan_value_scalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+static const char *scan_token_sse42(const char *p, const char *end)
+{
+    return scan_token_sse42_impl(p, end);
+}
+
+__attribute__((target("sse4.2")))
+static const char *scan_value_sse42(const char *p, const char *end)
+{
+    return scan_value_sse42_impl(p, end);
+}
+
+// AVX2 versions handle 32-byte blocks and leave the tail to SSE4.2.
+// Token check via nibble lookup: byte b is a tchar iff
+// token_lo[b & 15] & token_hi[b >> 4] is non-zero. Bytes >= 0x80 have a high
+// nibble >= 8, whose entry is 0. Built from token_chars at startup.
+static unsigned char token_lo[32] __attribute__((aligned(32)));
+static unsigned char token_hi[32] __attribute__((aligned(32)));
+
+static void build_token_lookup()
+{
+    for (int hi = 0; hi < 16; hi++)
+    {
+        token_hi[hi] = token_hi[hi + 16] = hi < 8 ? (unsigned char)(1 << hi) : 0;
+    }
+    for (int lo = 0; lo < 16; lo++)
+    {
+        unsigned char bits = 0;
+        for (int hi = 0; hi < 8; hi++)
+        {
+            if (token_chars[(hi << 4) | lo])
+                bits |= (unsigned char)(1 << hi);
+        }
+        token_lo[lo] = token_lo[lo + 16] = bits;
+    }
+}
+
+__attribute__((target("avx2,bmi,sse4.2")))
+static const char *scan_token_avx2(const char *p, const char *end)
+{
+    __m256i lo_table = _mm256_load_si256((const __m256i *)token_lo);
+    __m256i hi_table = _mm256_load_si256((const __m256i *)token_hi);
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(chunk, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+        __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+        if (mask)
+            return p + _tzcnt_u32(mask);
+        p += 32;
+    }
+    return scan_token_sse42_impl(p, end);
+}
+
+__attribute__((target("avx2,bmi,sse4.2")))
+static const char *scan_value_avx2(const char *p, const char *end)
+{
+    __m256i ctl_max = _mm256_set1_epi8(0x1f);
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        // chunk <= 0x1f (unsigned) and not HTAB, or DEL
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, ctl_max), chunk);
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab), ctl);
+        __m256i bad = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(chunk, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+        if (mask)
+            return p + _tzcnt_u32(mask);
+        p += 32;
+    }
+    return scan_value_sse42_impl(p, end);
+}
+#endif
+
+static ScanFn scan_token = scan_token_scalar;
+static ScanFn scan_value = scan_value_scalar;
+static HTTPSimdLevel simd_level = HTTP_SIMD_SCALAR;
+
+HTTPSimdLevel http_parser_simd_supported()
+{
+#ifdef HTTP_PARSER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+        __builtin_cpu_supports("sse4.2"))
+        return HTTP_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return HTTP_SIMD_SSE42;
+#endif
+    return HTTP_SIMD_SCALAR;
+}
+
+HTTPSimdLevel http_parser_set_simd(HTTPSimdLevel level)
+{
+    HTTPSimdLevel supported = http_parser_simd_supported();
+    if (level > supported)
+        level = supported;
+
+    scan_token = scan_token_scalar;
+    scan_value = scan_value_scalar;
+#ifdef HTTP_PARSER_X86
+    if (level == HTTP_SIMD_AVX2)
+    {
+        build_token_lookup();
+        scan_token = scan_token_avx2;
+        scan_value = scan_value_avx2;
+    }
+    else if (level == HTTP_SIMD_SSE42)
+    {
+        scan_token = scan_token_sse42;
+        scan_value = scan_value_sse42;
+    }
+#endif
+    simd_level = level;
+    return level;
+}
+
+HTTPSimdLevel http_parser_simd_level()
+{
+    return simd_level;
+}
+
+const char *http_parser_simd_name(HTTPSimdLevel level)
+{
+    switch (level)
+    {
+    case HTTP_SIMD_AVX2:
+        return "avx2";
+    case HTTP_SIMD_SSE42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+#ifdef __GNUC__
+// Pick the best scanner before main() so worker threads only ever read the
+// function pointers
+__attribute__((constructor)) static void http_parser_init_simd()
+{
+    http_parser_set_simd(HTTP_SIMD_AVX2);
+}
+#endif
+
+// ===== PARSER =====
+
+static HTTPParseStatus parse_error(HTTPRequest *request, int status)
+{
+    request->error_status = status;
+    return HTTP_PARSE_ERROR;
+}
+
+void http_request_init(HTTPRequest *request)
+{
+    memset(request, 0, sizeof(HTTPRequest));
+    request->state = PARSE_HEAD;
+}
+
+const StrView *http_request_header(const HTTPRequest *request, const char *name)
+{
+    for (int i = 0; i < request->header_count; i++)
+    {
+        if (strview_equals_nocase(request->headers[i].name, name))
+            return &request->headers[i].value;
+    }
+    return NULL;
+}
+
+// The caller may have moved its buffer (realloc) between calls; shift every
+// view we already handed out to the new location
+static void rebase(HTTPRequest *request, const char *buf)
+{
+    const char *old = request->base;
+    request->base = buf;
+    if (!old || old == buf || request->state == PARSE_HEAD)
+        return;
+
+#define REBASE(view) ((view).data = buf + ((view).data - old))
+    REBASE(request->method);
+    REBASE(request->path);
+    REBASE(request->query);
+    REBASE(request->version);
+    REBASE(request->body);
+    for (int i = 0; i < request->header_count; i++)
+    {
+        REBASE(request->headers[i].name);
+        REBASE(request->headers[i].value);
+    }
+#undef REBASE
+}
+
+// Find the blank line that ends the header block, resuming the scan where the
+// previous call stopped. Returns the offset just past it, or 0 if not found.
+static size_t find_head_end(HTTPRequest *request, const char *buf, size_t len)
+{
+    size_t i = request->scan_pos;
+    if (i < request->head_start + 1)
+        i = request->head_start + 1;
+
+    for (; i < len; i++)
+    {
+        const char *nl = memchr(buf + i, '\n', len - i);
+        if (!nl)
+            break;
+        i = nl - buf;
+        // "\n\n" or "\n\r\n"
+        if (buf[i - 1] == '\n')
+            return i + 1;
+        if (buf[i - 1] == '\r' && i >= request->head_start + 2 && buf[i - 2] == '\n')
+            return i + 1;
+    }
+
+    // The last two bytes may start a terminator completed by the next read
+    request->scan_pos = len > 2 ? len - 2 : 0;
+    return 0;
+}
+
+// Consume "\r\n" or a bare "\n"
+static const char *skip_eol(const char *p, const char *end)
+{
+    if (p < end && *p == '\r')
+        p++;
+    if (p < end && *p == '\n')
+        return p + 1;
+    return NULL;
+}
+
+// Does a comma-separated header value contain the given token?
+static int list_contains(StrView list, const char *token)
+{
+    size_t token_len = strlen(token);
+    const char *p = list.data;
+    const char *end = list.data + list.len;
+
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *start = p;
+        while (p < end && *p != ',')
+            p++;
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+            stop--;
+        if ((size_t)(stop - start) == token_len && strncasecmp(start, token, token_len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Check a Transfer-Encoding value, a comma-separated list of codings, each
+// a token with optional ";" parameters. Only chunked, once and without
+// parameters, is supported. Returns 0 and sets *chunked for it, 501 for any
+// other coding, and 400 for a malformed list or a repeated chunked.
+static int parse_transfer_encoding(StrView value, int *chunked)
+{
+    const char *p = value.data;
+    const char *end = value.data + value.len;
+    int codings = 0;
+
+    while (p < end)
+    {
+        // Empty list elements are allowed and ignored
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+
+        const char *start = p;
+        p = scan_token_scalar(p, end);
+        StrView coding = strview_make(start, p - start);
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        int has_params = p < end && *p == ';';
+        if (coding.len == 0 || (p < end && *p != ',' && !has_params))
+            return 400;
+        while (p < end && *p != ',')
+            p++;
+
+        if (!strview_equals_nocase(coding, "chunked"))
+            return 501;
+        if (has_params || *chunked)
+            return 400;
+        *chunked = 1;
+        codings++;
+    }
+    return codings > 0 ? 0 : 400;
+}
+
+// Interpret the headers that affect framing and connection handling
+static HTTPParseStatus apply_headers(HTTPRequest *request)
+{
+    int has_length = 0;
+    request->keep_alive = request->version.data[7] == '1';
+
+    for (int i = 0; i < request->header_count; i++)
+    {
+        StrView name = request->headers[i].name;
+        StrView value = request->headers[i].value;
+
+        if (strview_equals_nocase(name, "Content-Length"))
+        {
+            size_t length = 0;
+            if (value.len == 0)
+                return parse_error(request, 400);
+            for (size_t j = 0; j < value.len; j++)
+            {
+                if (value.data[j] < '0' || value.data[j] > '9')
+                    return parse_error(request, 400);
+                length = length * 10 + (value.data[j] - '0');
+                if (length > HTTP_MAX_BODY_BYTES)
+                    return parse_error(request, 413);
+            }
+            // Repeated Content-Length headers must agree
+            if (has_length && length != request->content_length)
+                return parse_error(request, 400);
+            request->content_length = length;
+            has_length = 1;
+        }
+        else if (strview_equals_nocase(name, "Transfer-Encoding"))
+        {
+            int status = parse_transfer_encoding(value, &request->chunked);
+            if (status != 0)
+                return parse_error(request, status);
+        }
+        else if (strview_equals_nocase(name, "Connection"))
+        {
+            if (list_contains(value, "close"))
+                request->keep_alive = 0;
+            else if (list_contains(value, "keep-alive"))
+                request->keep_alive = 1;
+        }
+        else if (strview_equals_nocase(name, "Expect"))
+        {
+            request->expect_continue = strview_equals_nocase(value, "100-continue");
+        }
+    }
+
+    // A message with both is a request smuggling vector; refuse it
+    if (request->chunked && has_length)
+        return parse_error(request, 400);
+
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+// Parse the request line and headers in buf[head_start, head_end)
+static HTTPParseStatus parse_head(HTTPRequest *request, const char *buf, size_t head_end)
+{
+    const char *p = buf + request->head_start;
+    const char *end = buf + head_end;
+    const char *start;
+
+    // Method
+    start = p;
+    p = scan_token(p, end);
+    if (p == start || p >= end || *p != ' ')
+        return parse_error(request, 400);
+    request->method = strview_make(start, p - start);
+    p++;
+
+    // Request target, split into path and query
+    start = p;
+    while (p < end && (unsigned char)*p > ' ' && *p != 0x7f)
+        p++;
+    if (p == start || p >= end || *p != ' ')
+        return parse_error(request, 400);
+    const char *question = memchr(start, '?', p - start);
+    if (question)
+    {
+        request->path = strview_make(start, question - start);
+        request->query = strview_make(question + 1, p - question - 1);
+    }
+    else
+    {
+        request->path = strview_make(start, p - start);
+        request->query = strview_make(p, 0);
+    }
+    p++;
+
+    // Version
+    if (end - p < 8 || memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1'))
+        return parse_error(request, 505);
+    request->version = strview_make(p, 8);
+    p = skip_eol(p + 8, end);
+    if (!p)
+        return parse_error(request, 400);
+
+    // Header fields, up to the blank line
+    while (p < end && *p != '\r' && *p != '\n')
+    {
+        if (request->header_count == HTTP_MAX_HEADERS)
+            return parse_error(request, 431);
+
+        start = p;
+        p = scan_token(p, end);
+        if (p == start || p >= end || *p != ':')
+            return parse_error(request, 400);
+        StrView name = strview_make(start, p - start);
+        p++;
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        start = p;
+        p = scan_value(p, end);
+        const char *value_end = p;
+        while (value_end > start && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+
+        p = skip_eol(p, end);
+        if (!p)
+            return parse_error(request, 400);
+
+        HTTPHeader *header = &request->headers[request->header_count++];
+        header->name = name;
+        header->value = strview_make(start, value_end - start);
+    }
+
+    return apply_headers(request);
+}
+
+// Decode as much of a chunked body as is available. Chunk data is moved down
+// over the chunk framing so the decoded body ends up contiguous right after
+// the headers; it never overtakes the raw bytes still to be read.
+static HTTPParseStatus parse_chunked(HTTPRequest *request, char *buf, size_t len)
+{
+    char *out = buf + request->head_len;
+
+    while (request->state != PARSE_DONE)
+    {
+        size_t pos = request->chunk_pos;
+
+        if (request->state == PARSE_CHUNK_SIZE || request->state == PARSE_TRAILERS)
+        {
+            const char *nl = memchr(buf + pos, '\n', len - pos);
+            if (!nl)
+            {
+                if (len - pos > 1024)
+                    return parse_error(request, 400);
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            const char *line = buf + pos;
+            const char *line_end = nl;
+            if (line_end > line && line_end[-1] == '\r')
+                line_end--;
+            request->chunk_pos = nl + 1 - buf;
+            request->framing_len += request->chunk_pos - pos;
+            if (request->framing_len > HTTP_MAX_FRAMING_BYTES)
+                return parse_error(request, 413);
+
+            if (request->state == PARSE_TRAILERS)
+            {
+                // An empty line ends the trailers (and the request)
+                if (line_end == line)
+                    request->state = PARSE_DONE;
+                continue;
+            }
+
+            size_t size = 0;
+            const char *p = line;
+            while (p < line_end && *p != ';' && *p != ' ' && *p != '\t')
+            {
+                int digit;
+                if (*p >= '0' && *p <= '9')
+                    digit = *p - '0';
+                else if (*p >= 'a' && *p <= 'f')
+                    digit = *p - 'a' + 10;
+                else if (*p >= 'A' && *p <= 'F')
+                    digit = *p - 'A' + 10;
+                else
+                    return parse_error(request, 400);
+                size = size * 16 + digit;
+                if (size > HTTP_MAX_BODY_BYTES)
+                    return parse_error(request, 413);
+                p++;
+            }
+            if (p == line)
+                return parse_error(request, 400);
+            if (request->body.len + size > HTTP_MAX_BODY_BYTES)
+                return parse_error(request, 413);
+
+            request->chunk_remaining = size;
+            request->state = size == 0 ? PARSE_TRAILERS : PARSE_CHUNK_DATA;
+        }
+        else if (request->state == PARSE_CHUNK_DATA)
+        {
+            size_t available = len - pos;
+            size_t n = available < request->chunk_remaining ? available : request->chunk_remaining;
+            memmove(out + request->body.len, buf + pos, n);
+            request->body.len += n;
+            request->chunk_pos += n;
+            request->chunk_remaining -= n;
+            if (request->chunk_remaining > 0)
+                return HTTP_PARSE_INCOMPLETE;
+            request->state = PARSE_CHUNK_CRLF;
+        }
+        else // PARSE_CHUNK_CRLF
+        {
+            if (len - pos < 1 || (buf[pos] == '\r' && len - pos < 2))
+                return HTTP_PARSE_INCOMPLETE;
+            const char *after = skip_eol(buf + pos, buf + len);
+            if (!after)
+                return parse_error(request, 400);
+            request->chunk_pos = after - buf;
+            request->framing_len += request->chunk_pos - pos;
+            request->state = PARSE_CHUNK_SIZE;
+        }
+    }
+
+    request->body.data = out;
+    request->length = request->chunk_pos;
+    return HTTP_PARSE_COMPLETE;
+}
+
+HTTPParseStatus http_request_parse(HTTPRequest *request, char *buf, size_t len)
+{
+    rebase(request, buf);
+
+    if (request->state == PARSE_HEAD)
+    {
+        // Tolerate blank lines before the request line (RFC 7230 3.5)
+        while (request->head_start < len &&
+               (buf[request->head_start] == '\r' || buf[request->head_start] == '\n'))
+        {
+            request->head_start++;
+        }
+
+        size_t head_end = find_head_end(request, buf, len);
+        if (head_end == 0)
+        {
+            if (len - request->head_start > HTTP_MAX_HEADER_BYTES)
+                return parse_error(request, 431);
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        if (head_end - request->head_start > HTTP_MAX_HEADER_BYTES)
+            return parse_error(request, 431);
+
+        request->head_len = head_end;
+        if (parse_head(request, buf, head_end) == HTTP_PARSE_ERROR)
+            return HTTP_PARSE_ERROR;
+
+        request->body = strview_make(buf + head_end, 0);
+        if (request->chunked)
+        {
+            request->chunk_pos = head_end;
+            request->state = PARSE_CHUNK_SIZE;
+        }
+        else
+        {
+            request->state = PARSE_BODY;
+        }
+    }
+
+    if (request->state == PARSE_BODY)
+    {
+        if (len - request->head_len < request->content_length)
+            return HTTP_PARSE_INCOMPLETE;
+        request->body = strview_make(buf + request->head_len, request->content_length);
+        request->length = request->head_len + request->content_length;
+        request->state = PARSE_DONE;
+        return HTTP_PARSE_COMPLETE;
+    }
+
+    if (request->state == PARSE_DONE)
+        return HTTP_PARSE_COMPLETE;
+
+    return parse_chunked(request, buf, len);
+}
+
+size_t http_request_compact(HTTPRequest *request, char *buf, size_t len)
+{
+    if (!request->chunked || request->state == PARSE_HEAD || request->state == PARSE_DONE)
+        return len;
+
+    // Decoded data ends where parse_chunked will write next
+    size_t decoded_end = request->head_len + request->body.len;
+    size_t dropped = request->chunk_pos - decoded_end;
+    if (dropped == 0)
+        return len;
+    memmove(buf + decoded_end, buf + request->chunk_pos, len - request->chunk_pos);
+    request->chunk_pos = decoded_end;
+    return len - dropped;
+}
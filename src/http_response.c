@@ -0,0 +1,175 @@
+#include "http_response.h"
+#include <string.h>
+
+// ===== STATUS LINES =====
+
+typedef struct {
+    int code;
+    const char *reason;
+    const char *line;  // Complete status line including "\r\n"
+    size_t len;
+} StatusLine;
+
+#define STATUS_LINE(code, reason) \
+    {code, reason, "HTTP/1.1 " #code " " reason "\r\n", sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1}
+
+// Sorted by code for binary search
+static const StatusLine status_lines[] = {
+    STATUS_LINE(100, "Continue"),
+    STATUS_LINE(101, "Switching Protocols"),
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(201, "Created"),
+    STATUS_LINE(202, "Accepted"),
+    STATUS_LINE(204, "No Content"),
+    STATUS_LINE(206, "Partial Content"),
+    STATUS_LINE(301, "Moved Permanently"),
+    STATUS_LINE(302, "Found"),
+    STATUS_LINE(303, "See Other"),
+    STATUS_LINE(304, "Not Modified"),
+    STATUS_LINE(307, "Temporary Redirect"),
+    STATUS_LINE(308, "Permanent Redirect"),
+    STATUS_LINE(400, "Bad Request"),
+    STATUS_LINE(401, "Unauthorized"),
+    STATUS_LINE(403, "Forbidden"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(405, "Method Not Allowed"),
+    STATUS_LINE(406, "Not Acceptable"),
+    STATUS_LINE(408, "Request Timeout"),
+    STATUS_LINE(409, "Conflict"),
+    STATUS_LINE(410, "Gone"),
+    STATUS_LINE(411, "Length Required"),
+    STATUS_LINE(412, "Precondition Failed"),
+    STATUS_LINE(413, "Payload Too Large"),
+    STATUS_LINE(414, "URI Too Long"),
+    STATUS_LINE(415, "Unsupported Media Type"),
+    STATUS_LINE(416, "Range Not Satisfiable"),
+    STATUS_LINE(417, "Expectation Failed"),
+    STATUS_LINE(422, "Unprocessable Content"),
+    STATUS_LINE(426, "Upgrade Required"),
+    STATUS_LINE(429, "Too Many Requests"),
+    STATUS_LINE(431, "Request Header Fields Too Large"),
+    STATUS_LINE(500, "Internal Server Error"),
+    STATUS_LINE(501, "Not Implemented"),
+    STATUS_LINE(502, "Bad Gateway"),
+    STATUS_LINE(503, "Service Unavailable"),
+    STATUS_LINE(504, "Gateway Timeout"),
+    STATUS_LINE(505, "HTTP Version Not Supported"),
+};
+
+#define STATUS_LINE_COUNT (sizeof(status_lines) / sizeof(status_lines[0]))
+
+static const StatusLine *find_status_line(int code)
+{
+    size_t lo = 0, hi = STATUS_LINE_COUNT;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (status_lines[mid].code == code)
+            return &status_lines[mid];
+        if (status_lines[mid].code < code)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+const char *http_status_reason(int status_code)
+{
+    const StatusLine *status = find_status_line(status_code);
+    return status ? status->reason : "";
+}
+
+int http_status_has_body(int status_code)
+{
+    return status_code >= 200 && status_code != 204 && status_code != 304;
+}
+
+// ===== HEAD =====
+
+#define APPEND_LITERAL(buf, str) bytebuffer_append((buf), (str), sizeof(str) - 1)
+
+// Write value in decimal at the end of buf; returns the number of digits
+static size_t format_size(char *buf, size_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        buf[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+void http_response_write_head(ByteBuffer *head, int status_code, StrView content_type,
+                              size_t content_length, int keep_alive,
+                              const ByteBuffer *extra_headers)
+{
+    if (status_code < 100 || status_code > 999)
+        status_code = 500;
+
+    const StatusLine *status = find_status_line(status_code);
+    if (status)
+    {
+        bytebuffer_append(head, status->line, status->len);
+    }
+    else
+    {
+        // Unregistered code: the reason phrase may be empty
+        char line[] = "HTTP/1.1 000 \r\n";
+        line[9] = (char)('0' + status_code / 100);
+        line[10] = (char)('0' + status_code / 10 % 10);
+        line[11] = (char)('0' + status_code % 10);
+        APPEND_LITERAL(head, line);
+    }
+
+    if (http_status_has_body(status_code))
+    {
+        APPEND_LITERAL(head, "Content-Type: ");
+        bytebuffer_append(head, content_type.data, content_type.len);
+        APPEND_LITERAL(head, "\r\nContent-Length: ");
+        char *digits = bytebuffer_reserve(head, 20);
+        head->len += format_size(digits, content_length);
+        APPEND_LITERAL(head, "\r\n");
+    }
+
+    if (keep_alive)
+        APPEND_LITERAL(head, "Connection: keep-alive\r\n");
+    else
+        APPEND_LITERAL(head, "Connection: close\r\n");
+
+    if (extra_headers)
+        bytebuffer_append(head, extra_headers->data, extra_headers->len);
+    APPEND_LITERAL(head, "\r\n");
+}
+
+int http_response_iov(const ByteBuffer *head, const ByteBuffer *body, size_t sent,
+                      struct iovec iov[HTTP_RESPONSE_IOV_COUNT])
+{
+    int count = 0;
+    if (sent < head->len)
+    {
+        iov[count].iov_base = head->data + sent;
+        iov[count].iov_len = head->len - sent;
+        count++;
+        sent = 0;
+    }
+    else
+    {
+        sent -= head->len;
+    }
+
+    if (body && sent < body->len)
+    {
+        iov[count].iov_base = body->data + sent;
+        iov[count].iov_len = body->len - sent;
+        count++;
+    }
+    return count;
+}
@@ -1,404 +1,852 @@
+#define _GNU_SOURCE
 #include "http_server.h"
+#include "loader.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Cross-platform socket includes
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-
-#define close closesocket
-typedef int socklen_t;
-#else
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#endif
 
 #define BUFFER_SIZE 4096
+#define MAX_EVENTS 256
 
-// ===== HTTP REQUEST PARSING =====
+// C stack of each worker thread. The tree-walker's calls may use all but
+// the reserve (see interpreter_set_c_stack), which is left for the
+// statements of the innermost call and the event loop below it.
+#define WORKER_STACK_SIZE (8 * 1024 * 1024)
+#define WORKER_STACK_RESERVE (256 * 1024)
 
-HTTPRequest *http_request_parse(const char *raw_request)
+// Large enough for a maximal request. Chunk framing takes no room: it is
+// dropped from the buffer as it is decoded (see connection_parse).
+#define MAX_READ_BUFFER (2 * (HTTP_MAX_HEADER_BYTES + HTTP_MAX_BODY_BYTES))
+
+// Response bodies larger than this are released once sent rather than kept
+// for the connection's next request
+#define MAX_IDLE_RESPONSE_BUFFER (64 * 1024)
+
+// ===== ROUTES =====
+
+// What the server needs to know about each route comes from the AST, or
+// from the bytecode when serving an image, which has no AST
+static int route_slot_count(const ServerProgram *program, int route)
 {
-    HTTPRequest *request = (HTTPRequest *)malloc(sizeof(HTTPRequest));
+    if (program->program)
+        return program->program->data.program.routes[route]->data.route.slot_count;
+    return (int)program->bytecode->routes[route].slot_count;
+}
 
-    // Make a copy we can modify
-    char *request_copy = strdup(raw_request);
-    char *line = strtok(request_copy, "\r\n");
+static int route_resolved(const ServerProgram *program, int route)
+{
+    if (program->program)
+        return program->program->data.program.routes[route]->data.route.resolved;
+    return (int)program->bytecode->routes[route].resolved;
+}
 
-    if (line)
+static const char *route_pattern(const ServerProgram *program, int route)
+{
+    if (program->program)
+        return program->program->data.program.routes[route]->data.route.path;
+    const BytecodeProgram *bytecode = program->bytecode;
+    return bytecode->pool + bytecode->strings[bytecode->routes[route].path];
+}
+
+static int route_is_constant(const ServerProgram *program, int route)
+{
+    if (program->program)
+        return program->program->data.program.routes[route]->data.route.is_constant;
+    return (int)program->bytecode->routes[route].is_constant;
+}
+
+static int runs_bytecode(const HTTPServer *server, const ServerProgram *program)
+{
+    return program->bytecode && (server->use_bytecode || !program->program);
+}
+
+// Run a route whose frame has been entered
+static void run_route(const HTTPServer *server, const ServerProgram *program,
+                      Interpreter *interp, int route)
+{
+    if (runs_bytecode(server, program))
+        vm_execute(program->bytecode, (uint32_t)route, interp);
+    else
+        execute_statement(interp, program->program->data.program.routes[route]->data.route.body);
+}
+
+int find_matching_route(const ServerProgram *program, int method, const char *path,
+                        size_t path_len, Interpreter *interp, RouteMatch *match)
+{
+    if (router_match(program->router, method, path, path_len, match) != ROUTER_MATCHED)
+        return -1;
+
+    // The resolver gives path parameters the first slots, in the order the
+    // router captures them; unresolved programs fall back to named variables
+    Value *frame = interpreter_enter_frame(interp, route_slot_count(program, match->route));
+    int resolved = route_resolved(program, match->route);
+    for (int i = 0; i < match->param_count; i++)
     {
-        // Parse request line: "GET /path HTTP/1.1"
-        char method[16], path[256], version[16];
-        if (sscanf(line, "%15s %255s %15s", method, path, version) == 3)
-        {
-            request->method = strdup(method);
-            request->path = strdup(path);
-            request->version = strdup(version);
-        }
+        Value val = value_create_arena_string(&interp->arena, match->params[i].value.data,
+                                              match->params[i].value.len);
+        if (resolved)
+            frame[i] = val;
         else
+            set_variable(interp, match->params[i].name.data, val);
+    }
+    return match->route;
+}
+
+// Append "Allow: GET, POST\r\n" for a router method mask
+static void append_allow_header(ByteBuffer *headers, uint32_t allowed)
+{
+    const char *separator = "Allow: ";
+    for (int i = 0; i < ROUTER_METHOD_ANY; i++)
+    {
+        if (!(allowed & (1u << i)))
+            continue;
+        bytebuffer_append_str(headers, separator);
+        bytebuffer_append_str(headers, router_method_name(i));
+        separator = ", ";
+    }
+    bytebuffer_append(headers, "\r\n", 2);
+}
+
+// ===== HTTP SERVER =====
+
+// Each connection moves through read -> parse -> execute -> write. Any step
+// that would block leaves the connection in its current state until epoll
+// reports the socket ready again, so one slow client never stalls the rest.
+typedef enum
+{
+    CONN_READING,
+    CONN_WRITING
+} ConnectionState;
+
+// A worker owns one listening socket (bound with SO_REUSEPORT so the kernel
+// spreads new connections across workers), one event loop and one
+// interpreter. Workers share nothing but the read-only program.
+//
+// Reloads never make a worker wait: it loads server->current once per
+// batch of events and keeps nothing from it between batches, so a replaced
+// program can be freed as soon as every worker has finished the batch it
+// was in (see wait_for_workers).
+typedef struct Connection Connection;
+
+struct HTTPWorker
+{
+    int id;
+    HTTPServer *server;
+    int socket_fd;
+    int epoll_fd;
+    Interpreter *interpreter;
+    pthread_t thread;
+    size_t stack_size;       // Of the thread running the worker
+    ServerProgram *program;  // For the current batch of events
+    unsigned long epoch;     // Odd while handling a batch; read by the reloader
+
+    // Open connections, least recently active first, so idle ones can be
+    // expired from the head without scanning the whole list
+    Connection *conn_head;
+    Connection *conn_tail;
+};
+
+struct Connection
+{
+    int fd;
+    ConnectionState state;
+    int keep_alive;        // Keep the connection open after this response
+    int requests_served;
+    long long last_active; // Monotonic milliseconds
+    Connection *prev;
+    Connection *next;
+
+    // Read buffer: bytes before read_start belong to requests already
+    // answered; the request being parsed starts at read_start. Grows for
+    // large requests and shrinks back once they are consumed.
+    char *read_buf;
+    size_t read_cap;
+    size_t read_start;
+    size_t read_len;
+    HTTPRequest request;   // Parse state for the request at read_start
+    int sent_continue;     // "100 Continue" already sent for this request
+
+    // Pending response. The route writes status, headers and body into
+    // response; only the head (status line and headers) is serialized, and
+    // both go out in one sendmsg so the body is never copied again. The
+    // buffers are reused for the connection's next response.
+    RouteResponse response;
+    ByteBuffer head;
+    int send_body;         // Not for HEAD requests or statuses without a body
+    size_t write_pos;      // Bytes of head + body already sent
+
+    // Set instead of head + body when the route's response was cached. Points
+    // into the program, so it only lasts until the end of the batch; only
+    // its first static_len bytes are sent.
+    const ByteBuffer *static_response;
+    size_t static_len;
+};
+
+// Run every constant route once and keep its complete response, so serving
+// it later is a single send with no interpreter involved
+static void build_static_responses(HTTPServer *server, ServerProgram *program)
+{
+    int route_count = (int)program->router->route_count;
+    program->static_responses = (StaticResponse *)calloc(route_count > 0 ? route_count : 1,
+                                                         sizeof(StaticResponse));
+
+    Interpreter *interp = interpreter_init();
+    RouteResponse response;
+    route_response_init(&response);
+
+    for (int i = 0; i < route_count; i++)
+    {
+        if (!route_is_constant(program, i))
+            continue;
+
+        route_response_reset(&response);
+        interpreter_enter_frame(interp, route_slot_count(program, i));
+        interp->response = &response;
+        run_route(server, program, interp, i);
+        interp->response = NULL;
+        interpreter_reset(interp);
+
+        for (int keep_alive = 0; keep_alive < 2; keep_alive++)
         {
-            request->method = strdup("GET");
-            request->path = strdup("/");
-            request->version = strdup("HTTP/1.1");
+            ByteBuffer *bytes = &program->static_responses[i].bytes[keep_alive];
+            http_response_write_head(bytes, response.status_code, response.content_type,
+                                     response.body.len, keep_alive, &response.headers);
+            program->static_responses[i].head_len[keep_alive] = bytes->len;
+            if (http_status_has_body(response.status_code))
+                bytebuffer_append(bytes, response.body.data, response.body.len);
         }
-
-        // Skip headers for now (simple implementation)
-        request->headers = strdup("");
-        request->body = strdup("");
     }
 
-    free(request_copy);
-    return request;
+    route_response_free(&response);
+    interpreter_free(interp);
 }
 
-void http_request_free(HTTPRequest *request)
+// Compile a program for serving; an image needs no compiling
+static ServerProgram *program_create(HTTPServer *server, ASTNode *ast, ProgramImage *image,
+                                     int owned)
 {
-    if (!request)
-        return;
-    free(request->method);
-    free(request->path);
-    free(request->version);
-    free(request->headers);
-    free(request->body);
-    free(request);
+    ServerProgram *program = (ServerProgram *)calloc(1, sizeof(ServerProgram));
+    program->program = ast;
+    program->image = image;
+    program->owned = owned;
+    if (ast)
+    {
+        program->router = router_compile(ast);
+        program->bytecode = bytecode_compile(ast);
+    }
+    else
+    {
+        program->router = &image->router;
+        program->bytecode = &image->bytecode;
+    }
+    build_static_responses(server, program);
+    return program;
 }
 
-// ===== HTTP RESPONSE =====
+static int has_memo_functions(const ServerProgram *program)
+{
+    if (program->program)
+    {
+        ASTNode *ast = program->program;
+        for (int i = 0; i < ast->data.program.function_count; i++)
+        {
+            if (ast->data.program.functions[i]->data.function.memo)
+                return 1;
+        }
+        return 0;
+    }
+    for (uint32_t i = 0; i < program->bytecode->function_count; i++)
+    {
+        if (program->bytecode->functions[i].memo)
+            return 1;
+    }
+    return 0;
+}
 
-HTTPResponse *http_response_create(int status_code, const char *content_type, const char *body)
+// Each worker's static hit counters take whole cache lines, so workers
+// never write to the same one
+static size_t static_hits_stride(const ServerProgram *program)
 {
-    HTTPResponse *response = (HTTPResponse *)malloc(sizeof(HTTPResponse));
-    response->status_code = status_code;
+    return program->router->route_count / 8 * 8 + 8;
+}
 
-    switch (status_code)
+// Per-worker state, sized once the worker count is known
+static void program_start(HTTPServer *server, ServerProgram *program)
+{
+    program->static_hits = (unsigned long *)calloc(static_hits_stride(program) * server->worker_count,
+                                                   sizeof(unsigned long));
+    if (server->memo_entries > 0 && has_memo_functions(program))
+        program->memo = memo_cache_create((size_t)server->memo_entries);
+}
+
+static void program_free(ServerProgram *program)
+{
+    for (uint32_t i = 0; i < program->router->route_count; i++)
+    {
+        bytebuffer_free(&program->static_responses[i].bytes[0]);
+        bytebuffer_free(&program->static_responses[i].bytes[1]);
+    }
+    free(program->static_responses);
+    free(program->static_hits);
+    memo_cache_free(program->memo);
+    if (program->program)
+    {
+        // Compiled by program_create; an image's belong to the image
+        router_free(program->router);
+        bytecode_free(program->bytecode);
+    }
+    if (program->owned)
     {
-    case 200:
-        response->status_text = strdup("OK");
-        break;
-    case 404:
-        response->status_text = strdup("Not Found");
-        break;
-    case 500:
-        response->status_text = strdup("Internal Server Error");
-        break;
-    default:
-        response->status_text = strdup("Unknown");
-        break;
+        ast_free(program->program);
+        image_close(program->image);
     }
+    free(program);
+}
+
+static HTTPServer *server_create(int port)
+{
+    HTTPServer *server = (HTTPServer *)malloc(sizeof(HTTPServer));
+    server->port = port;
+    server->running = 0;
+    server->log_requests = 1;
+    server->keepalive_timeout_ms = 5000;
+    server->max_keepalive_requests = 1000;
+    server->current = NULL;
+    server->path = NULL;
+    server->reload = 1;
+    server->use_bytecode = 1;
+    server->max_call_depth = INTERPRETER_MAX_CALL_DEPTH;
+    server->memo_entries = MEMO_DEFAULT_ENTRIES;
+    server->worker_count = 1;
+    server->workers = NULL;
+    return server;
+}
+
+HTTPServer *http_server_create(int port, ASTNode *program)
+{
+    HTTPServer *server = server_create(port);
+    server->current = program_create(server, program, NULL, 0);
+    return server;
+}
 
-    response->content_type = strdup(content_type);
-    response->body = strdup(body);
-    return response;
+HTTPServer *http_server_create_from_image(int port, ProgramImage *image)
+{
+    HTTPServer *server = server_create(port);
+    server->current = program_create(server, NULL, image, 0);
+    return server;
 }
 
-char *http_response_to_string(HTTPResponse *response)
+HTTPServer *http_server_create_from_file(int port, const char *path)
 {
-    size_t size = 512 + strlen(response->body);
-    char *result = (char *)malloc(size);
+    LoadedProgram loaded;
+    if (program_load(path, &loaded) < 0)
+        return NULL;
 
-    snprintf(result, size,
-             "HTTP/1.1 %d %s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "Connection: close\r\n"
-             "\r\n"
-             "%s",
-             response->status_code,
-             response->status_text,
-             response->content_type,
-             strlen(response->body),
-             response->body);
+    HTTPServer *server = server_create(port);
+    server->path = path;
+    server->current = program_create(server, loaded.ast, loaded.image, 1);
+    return server;
+}
 
-    return result;
+void http_server_set_workers(HTTPServer *server, int count)
+{
+    server->worker_count = count > 0 ? count : 1;
 }
 
-void http_response_free(HTTPResponse *response)
+void http_server_free(HTTPServer *server)
 {
-    if (!response)
+    if (!server)
         return;
-    free(response->status_text);
-    free(response->content_type);
-    free(response->body);
-    free(response);
+    if (server->workers)
+    {
+        for (int i = 0; i < server->worker_count; i++)
+        {
+            HTTPWorker *worker = &server->workers[i];
+            if (worker->socket_fd >= 0)
+                close(worker->socket_fd);
+            if (worker->epoll_fd >= 0)
+                close(worker->epoll_fd);
+            interpreter_free(worker->interpreter);
+        }
+        free(server->workers);
+    }
+    program_free(server->current);
+    free(server);
 }
 
-// ===== ROUTE MATCHING =====
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Serialize the status line and headers for conn->response into conn->head.
+// A HEAD request gets the head the GET response would have, without the body.
+static void connection_prepare_head(Connection *conn, int head_request)
+{
+    RouteResponse *response = &conn->response;
+
+    bytebuffer_reset(&conn->head);
+    conn->static_response = NULL;
+    http_response_write_head(&conn->head, response->status_code, response->content_type,
+                             response->body.len, conn->keep_alive, &response->headers);
+    conn->send_body = !head_request && http_status_has_body(response->status_code);
+    conn->write_pos = 0;
+}
 
-// Check if a route path matches with parameters (e.g., /user/:id matches /user/123)
-static int route_matches(const char *route_pattern, const char *request_path,
-                         char params[][256], char values[][256], int *param_count)
+// Execute the route for a parsed request, leaving the response in conn
+static void build_response(HTTPWorker *worker, Connection *conn)
 {
-    *param_count = 0;
+    HTTPServer *server = worker->server;
+    ServerProgram *program = worker->program;
+    HTTPRequest *request = &conn->request;
+    RouteResponse *response = &conn->response;
 
-    // Split both paths by '/'
-    char pattern_copy[256], path_copy[256];
-    strncpy(pattern_copy, route_pattern, 255);
-    strncpy(path_copy, request_path, 255);
+    if (server->log_requests)
+        printf("Request: %.*s %.*s\n", (int)request->method.len, request->method.data,
+               (int)request->path.len, request->path.data);
 
-    char *pattern_parts[32];
-    char *path_parts[32];
-    int pattern_count = 0, path_count = 0;
+    route_response_reset(response);
 
-    // Tokenize pattern
-    char *p = strtok(pattern_copy, "/");
-    while (p && pattern_count < 32)
+    // Find matching route (will inject params into interpreter)
+    RouteMatch match;
+    int method = router_parse_method(request->method.data, request->method.len);
+    int head_request = method == ROUTER_METHOD_HEAD;
+    int route = find_matching_route(program, method, request->path.data, request->path.len,
+                                    worker->interpreter, &match);
+
+    if (route >= 0 && program->static_responses[route].bytes[conn->keep_alive].len > 0)
     {
-        pattern_parts[pattern_count++] = p;
-        p = strtok(NULL, "/");
+        // Constant route: send the bytes built at load time as they are
+        const StaticResponse *cached = &program->static_responses[route];
+        interpreter_reset(worker->interpreter);
+        program->static_hits[static_hits_stride(program) * worker->id + route]++;
+        conn->static_response = &cached->bytes[conn->keep_alive];
+        conn->static_len = head_request ? cached->head_len[conn->keep_alive]
+                                        : conn->static_response->len;
+        conn->send_body = 0;
+        conn->write_pos = 0;
+        return;
     }
 
-    // Tokenize path
-    p = strtok(path_copy, "/");
-    while (p && path_count < 32)
+    if (route >= 0)
     {
-        path_parts[path_count++] = p;
-        p = strtok(NULL, "/");
+        // The route's response statements write straight into the buffer
+        worker->interpreter->response = response;
+        run_route(server, program, worker->interpreter, route);
+        worker->interpreter->response = NULL;
+
+        // A runtime error (such as runaway recursion) discards whatever
+        // the route had written
+        if (worker->interpreter->error)
+        {
+            route_response_reset(response);
+            response->status_code = 500;
+            bytebuffer_appendf(&response->body, "500 Internal Server Error - %s",
+                               worker->interpreter->error);
+        }
+
+        // Clear variables for next request
+        interpreter_reset(worker->interpreter);
+    }
+    else if (match.allowed)
+    {
+        response->status_code = 405;
+        bytebuffer_appendf(&response->body, "405 Method Not Allowed - Route '%.*s' does not accept %.*s",
+                           (int)request->path.len, request->path.data,
+                           (int)request->method.len, request->method.data);
+        append_allow_header(&response->headers, match.allowed);
+    }
+    else
+    {
+        // 404 Not Found
+        response->status_code = 404;
+        bytebuffer_appendf(&response->body, "404 Not Found - Route '%.*s' not defined",
+                           (int)request->path.len, request->path.data);
     }
 
-    // Must have same number of parts
-    if (pattern_count != path_count)
-        return 0;
+    connection_prepare_head(conn, head_request);
+}
+
+static long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Move a connection to the most-recently-active end of the worker's list
+static void connection_touch(HTTPWorker *worker, Connection *conn)
+{
+    conn->last_active = monotonic_ms();
+    if (worker->conn_tail == conn)
+        return;
+
+    // Unlink
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else if (worker->conn_head == conn)
+        worker->conn_head = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    // Append
+    conn->prev = worker->conn_tail;
+    conn->next = NULL;
+    if (worker->conn_tail)
+        worker->conn_tail->next = conn;
+    else
+        worker->conn_head = conn;
+    worker->conn_tail = conn;
+}
+
+static void connection_close(HTTPWorker *worker, Connection *conn)
+{
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        worker->conn_head = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    else
+        worker->conn_tail = conn->prev;
 
-    // Check each part
-    for (int i = 0; i < pattern_count; i++)
+    close(conn->fd);
+    free(conn->read_buf);
+    route_response_free(&conn->response);
+    bytebuffer_free(&conn->head);
+    free(conn);
+}
+
+// Close connections that have been idle longer than the keep-alive timeout
+static void expire_idle_connections(HTTPWorker *worker)
+{
+    long long cutoff = monotonic_ms() - worker->server->keepalive_timeout_ms;
+    while (worker->conn_head && worker->conn_head->last_active < cutoff)
+    {
+        connection_close(worker, worker->conn_head);
+    }
+}
+
+// Write as much of the pending response as the socket accepts.
+// Returns 1 when everything has been sent, 0 if the socket is full, -1 on error.
+static int connection_flush(Connection *conn)
+{
+    struct iovec iov[HTTP_RESPONSE_IOV_COUNT];
+    int iov_count;
+
+    // Gather whatever is left of the head and the body; sendmsg rather than
+    // writev so a closed peer can't raise SIGPIPE
+    const ByteBuffer *head = &conn->head;
+    const ByteBuffer *body = conn->send_body ? &conn->response.body : NULL;
+    ByteBuffer cached;
+    if (conn->static_response)
     {
-        if (pattern_parts[i][0] == ':')
+        cached = *conn->static_response;
+        cached.len = conn->static_len;
+        head = &cached;
+    }
+    while ((iov_count = http_response_iov(head, body, conn->write_pos, iov)) > 0)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (n > 0)
         {
-            // This is a parameter
-            strncpy(params[*param_count], pattern_parts[i] + 1, 255);
-            strncpy(values[*param_count], path_parts[i], 255);
-            (*param_count)++;
+            conn->write_pos += (size_t)n;
         }
-        else
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
         {
-            // Must match exactly
-            if (strcmp(pattern_parts[i], path_parts[i]) != 0)
+            // The rest of a cached response has to outlive the batch, and
+            // with it possibly the program (see HTTPWorker): keep a copy
+            if (conn->static_response)
             {
-                return 0;
+                bytebuffer_reset(&conn->head);
+                bytebuffer_append(&conn->head, conn->static_response->data + conn->write_pos,
+                                  conn->static_len - conn->write_pos);
+                conn->static_response = NULL;
+                conn->write_pos = 0;
             }
+            return 0;
+        }
+        else
+        {
+            return -1;
         }
     }
-
     return 1;
 }
 
-ASTNode *find_matching_route(ASTNode *program, const char *path, Interpreter *interp)
+// Make room for more input: drop answered requests from the front, then
+// grow. Returns 0 once the buffer has reached its limit.
+static int connection_reserve(Connection *conn)
 {
-    if (program->type != AST_PROGRAM)
-        return NULL;
+    if (conn->read_start > 0)
+    {
+        conn->read_len -= conn->read_start;
+        memmove(conn->read_buf, conn->read_buf + conn->read_start, conn->read_len);
+        conn->read_start = 0;
+        if (conn->read_len < conn->read_cap)
+            return 1;
+    }
+
+    if (conn->read_cap >= MAX_READ_BUFFER)
+        return 0;
+    conn->read_cap *= 2;
+    conn->read_buf = (char *)realloc(conn->read_buf, conn->read_cap);
+    return 1;
+}
 
-    for (int i = 0; i < program->data.program.route_count; i++)
+// Drain the socket into the read buffer.
+// Returns 1 if the peer is still connected, 0 on EOF or error.
+static int connection_fill(Connection *conn)
+{
+    while (1)
     {
-        ASTNode *route = program->data.program.routes[i];
+        if (conn->read_len == conn->read_cap && !connection_reserve(conn))
+            return 1; // Full; the parser reports the request as too large
 
-        // Check for exact match first
-        if (strcmp(route->data.route.path, path) == 0)
+        ssize_t n = recv(conn->fd, conn->read_buf + conn->read_len,
+                         conn->read_cap - conn->read_len, 0);
+        if (n > 0)
         {
-            return route;
+            conn->read_len += (size_t)n;
         }
-
-        // Check for parameter match
-        char params[8][256], values[8][256];
-        int param_count = 0;
-        if (route_matches(route->data.route.path, path, params, values, &param_count))
+        else if (n < 0 && errno == EINTR)
         {
-            // Store parameters as variables in interpreter
-            for (int j = 0; j < param_count; j++)
-            {
-                Value val = value_create_string(values[j]);
-                set_variable(interp, params[j], val);
-            }
-            return route;
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 1;
+        }
+        else
+        {
+            return 0;
         }
     }
-
-    return NULL;
 }
 
-// ===== HTTP SERVER =====
-
-HTTPServer *http_server_create(int port, ASTNode *program)
+static HTTPParseStatus connection_parse(Connection *conn)
 {
-    HTTPServer *server = (HTTPServer *)malloc(sizeof(HTTPServer));
-    server->port = port;
-    server->socket_fd = -1;
-    server->program = program;
-    server->interpreter = interpreter_init();
-    return server;
+    char *buf = conn->read_buf + conn->read_start;
+    HTTPParseStatus status = http_request_parse(&conn->request, buf,
+                                                conn->read_len - conn->read_start);
+    if (status == HTTP_PARSE_INCOMPLETE)
+        conn->read_len = conn->read_start +
+                         http_request_compact(&conn->request, buf, conn->read_len - conn->read_start);
+    return status;
 }
 
-void http_server_free(HTTPServer *server)
+// Queue the response for the request at read_start and drop that request
+// from the read buffer, leaving any pipelined requests behind it in place
+static void connection_serve(HTTPWorker *worker, Connection *conn)
 {
-    if (!server)
-        return;
-    if (server->socket_fd >= 0)
+    HTTPServer *server = worker->server;
+    HTTPRequest *request = &conn->request;
+
+    conn->requests_served++;
+    conn->keep_alive = request->keep_alive && server->running &&
+                       conn->requests_served < server->max_keepalive_requests;
+
+    build_response(worker, conn);
+    conn->state = CONN_WRITING;
+
+    conn->read_start += request->length;
+    if (conn->read_start == conn->read_len)
     {
-        close(server->socket_fd);
+        conn->read_start = 0;
+        conn->read_len = 0;
+        if (conn->read_cap > BUFFER_SIZE)
+        {
+            conn->read_cap = BUFFER_SIZE;
+            conn->read_buf = (char *)realloc(conn->read_buf, conn->read_cap);
+        }
     }
-    interpreter_free(server->interpreter);
-    free(server);
+    http_request_init(&conn->request);
+    conn->sent_continue = 0;
 }
 
-// Handle a single client request
-static void handle_client(HTTPServer *server, int client_fd)
+// Answer a request the parser rejected, then hang up
+static void connection_reject(Connection *conn, int status)
 {
-    char buffer[BUFFER_SIZE];
-#ifdef _WIN32
-    int bytes_read = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-#else
-    ssize_t bytes_read = read(client_fd, buffer, BUFFER_SIZE - 1);
-#endif
+    route_response_reset(&conn->response);
+    conn->response.status_code = status;
+    bytebuffer_append_str(&conn->response.body, http_status_reason(status));
 
-    if (bytes_read <= 0)
+    conn->keep_alive = 0;
+    connection_prepare_head(conn, 0);
+    conn->state = CONN_WRITING;
+}
+
+// Advance a connection's state machine after epoll reported activity. Keeps
+// going until the socket would block, so requests pipelined behind the
+// current one are answered (in order) without waiting for another event.
+static void connection_on_event(HTTPWorker *worker, Connection *conn, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP))
     {
-        close(client_fd);
+        connection_close(worker, conn);
         return;
     }
 
-    buffer[bytes_read] = '\0';
+    connection_touch(worker, conn);
 
-    // Parse request
-    HTTPRequest *request = http_request_parse(buffer);
-    printf("Request: %s %s\n", request->method, request->path);
-
-    // Find matching route (will inject params into interpreter)
-    ASTNode *route = find_matching_route(server->program, request->path, server->interpreter);
-
-    HTTPResponse *response;
-
-    if (route)
+    while (1)
     {
-        // Create a memory buffer to capture output
-        char output_buffer[4096] = {0};
-
-#ifdef _WIN32
-        // Windows: use temporary file
-        FILE *mem_stream = tmpfile();
-#else
-        // Unix: use fmemopen
-        FILE *mem_stream = fmemopen(output_buffer, sizeof(output_buffer), "w");
-#endif
-
-        if (mem_stream)
+        if (conn->state == CONN_WRITING)
         {
-            // Redirect interpreter output to memory
-            server->interpreter->output = mem_stream;
-
-            // Execute the route
-            execute_statement(server->interpreter, route->data.route.body);
-
-            fflush(mem_stream);
-
-#ifdef _WIN32
-            // Windows: read back from temp file
-            rewind(mem_stream);
-            size_t read_size = fread(output_buffer, 1, sizeof(output_buffer) - 1, mem_stream);
-            output_buffer[read_size] = '\0';
-#endif
-
-            fclose(mem_stream);
-
-            // Reset output to stdout
-            server->interpreter->output = stdout;
-
-            // Parse the output to extract content type and body
-            char *content_type = "text/plain";
-            char *body_start = output_buffer;
-
-            if (strstr(output_buffer, "Content-Type: text/html") != NULL)
+            int sent = connection_flush(conn);
+            if (sent == 0)
+                return; // Wait for EPOLLOUT
+            if (sent < 0 || !conn->keep_alive)
             {
-                content_type = "text/html";
-                // Find the actual body (after blank line)
-                body_start = strstr(output_buffer, "\n\n");
-                if (body_start)
-                    body_start += 2;
+                connection_close(worker, conn);
+                return;
             }
-            else if (strstr(output_buffer, "Content-Type: text/plain") != NULL)
+            if (conn->response.body.cap > MAX_IDLE_RESPONSE_BUFFER)
+                bytebuffer_free(&conn->response.body);
+            conn->state = CONN_READING;
+        }
+
+        HTTPParseStatus status = connection_parse(conn);
+        if (status == HTTP_PARSE_INCOMPLETE)
+        {
+            size_t before = conn->read_len - conn->read_start;
+            int open = connection_fill(conn);
+            int full = conn->read_len == conn->read_cap;
+            if (conn->read_len - conn->read_start != before)
+                status = connection_parse(conn);
+            if (status == HTTP_PARSE_INCOMPLETE)
             {
-                content_type = "text/plain";
-                body_start = strstr(output_buffer, "\n\n");
-                if (body_start)
-                    body_start += 2;
+                if (!open)
+                {
+                    connection_close(worker, conn);
+                    return;
+                }
+                // A full buffer stops the fill before the socket is drained,
+                // and edge-triggered epoll won't report the rest again: read
+                // on if decoding chunks made room
+                if (full && conn->read_len < conn->read_cap)
+                    continue;
+                if (conn->read_start > 0 || conn->read_len < MAX_READ_BUFFER)
+                {
+                    // Clients sending "Expect: 100-continue" wait for this
+                    // before uploading the body. Checked after the fill, as
+                    // the head usually arrives in the read that just ended.
+                    if (conn->request.expect_continue && !conn->sent_continue)
+                    {
+                        static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                        send(conn->fd, interim, sizeof(interim) - 1, MSG_NOSIGNAL);
+                        conn->sent_continue = 1;
+                    }
+                    return; // Wait for more data
+                }
+                conn->request.error_status = 413;
+                status = HTTP_PARSE_ERROR;
             }
-
-            response = http_response_create(200, content_type, body_start ? body_start : output_buffer);
         }
-        else
+
+        if (status == HTTP_PARSE_ERROR)
         {
-            response = http_response_create(500, "text/plain", "Internal Server Error");
+            connection_reject(conn, conn->request.error_status);
+            continue;
         }
 
-        // Clear variables for next request
-        interpreter_free(server->interpreter);
-        server->interpreter = interpreter_init();
-    }
-    else
-    {
-        // 404 Not Found
-        char not_found[256];
-        snprintf(not_found, sizeof(not_found),
-                 "404 Not Found - Route '%s' not defined", request->path);
-        response = http_response_create(404, "text/plain", not_found);
+        connection_serve(worker, conn);
     }
+}
 
-    // Send response
-    char *response_str = http_response_to_string(response);
-#ifdef _WIN32
-    send(client_fd, response_str, strlen(response_str), 0);
-#else
-    write(client_fd, response_str, strlen(response_str));
-#endif
+// Accept every pending connection on the (edge-triggered) listening socket
+static void accept_connections(HTTPWorker *worker)
+{
+    while (1)
+    {
+        int client_fd = accept4(worker->socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Accept failed");
+            return;
+        }
 
-    // Cleanup
-    free(response_str);
-    http_response_free(response);
-    http_request_free(request);
-    close(client_fd);
+        Connection *conn = (Connection *)malloc(sizeof(Connection));
+        conn->fd = client_fd;
+        conn->state = CONN_READING;
+        conn->keep_alive = 0;
+        conn->requests_served = 0;
+        conn->prev = NULL;
+        conn->next = NULL;
+        conn->read_buf = (char *)malloc(BUFFER_SIZE);
+        conn->read_cap = BUFFER_SIZE;
+        conn->read_start = 0;
+        conn->read_len = 0;
+        http_request_init(&conn->request);
+        conn->sent_continue = 0;
+        route_response_init(&conn->response);
+        bytebuffer_init(&conn->head);
+        conn->send_body = 0;
+        conn->write_pos = 0;
+        conn->static_response = NULL;
+        conn->static_len = 0;
+        connection_touch(worker, conn);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0)
+        {
+            perror("epoll_ctl failed");
+            connection_close(worker, conn);
+        }
+    }
 }
 
-void http_server_start(HTTPServer *server)
+// Create a worker's listening socket and event loop. SO_REUSEPORT lets every
+// worker bind the same port; the kernel load-balances accepts between them.
+static void worker_listen(HTTPWorker *worker)
 {
     struct sockaddr_in address;
     int opt = 1;
 
-#ifdef _WIN32
-    // Initialize Winsock
-    WSADATA wsa_data;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
-    {
-        fprintf(stderr, "WSAStartup failed\n");
-        exit(EXIT_FAILURE);
-    }
-#endif
-
     // Create socket
-    server->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-#ifdef _WIN32
-    if (server->socket_fd == INVALID_SOCKET)
+    worker->socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (worker->socket_fd == -1)
     {
-#else
-    if (server->socket_fd == -1)
-    {
-#endif
         perror("Socket creation failed");
         exit(EXIT_FAILURE);
     }
 
-// Set socket options
-#ifdef _WIN32
-    if (setsockopt(server->socket_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt)))
-    {
-#else
-    if (setsockopt(server->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+    // Set socket options
+    if (setsockopt(worker->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(worker->socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
     {
-#endif
         perror("Setsockopt failed");
         exit(EXIT_FAILURE);
     }
@@ -406,64 +854,331 @@ void http_server_start(HTTPServer *server)
     // Bind socket to port
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(server->port);
+    address.sin_port = htons(worker->server->port);
 
-    if (bind(server->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    if (bind(worker->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
     {
         perror("Bind failed");
         exit(EXIT_FAILURE);
     }
 
     // Listen for connections
-    if (listen(server->socket_fd, 10) < 0)
+    if (listen(worker->socket_fd, SOMAXCONN) < 0)
     {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
 
+    if (set_nonblocking(worker->socket_fd) < 0)
+    {
+        perror("Failed to make socket non-blocking");
+        exit(EXIT_FAILURE);
+    }
+
+    // Create the event loop; the listening socket is tagged with a NULL pointer
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epoll_fd < 0)
+    {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event listen_ev;
+    listen_ev.events = EPOLLIN | EPOLLET;
+    listen_ev.data.ptr = NULL;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->socket_fd, &listen_ev) < 0)
+    {
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Worker event loop; the timeout lets us notice http_server_stop()
+static void *worker_run(void *arg)
+{
+    HTTPWorker *worker = (HTTPWorker *)arg;
+    HTTPServer *server = worker->server;
+    struct epoll_event events[MAX_EVENTS];
+
+    size_t reserve = worker->stack_size > 2 * WORKER_STACK_RESERVE ? WORKER_STACK_RESERVE
+                                                                    : worker->stack_size / 2;
+    interpreter_set_c_stack(worker->interpreter, worker->stack_size - reserve);
+
+    while (server->running)
+    {
+        expire_idle_connections(worker);
+
+        int count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 1000);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        // Announce the batch before loading the program, so a reloader that
+        // swaps it in between is sure to wait for us
+        __atomic_add_fetch(&worker->epoch, 1, __ATOMIC_SEQ_CST);
+        worker->program = __atomic_load_n(&server->current, __ATOMIC_SEQ_CST);
+        worker->interpreter->memo = worker->program->memo;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                accept_connections(worker);
+            }
+            else
+            {
+                connection_on_event(worker, (Connection *)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        worker->program = NULL;
+        __atomic_add_fetch(&worker->epoch, 1, __ATOMIC_SEQ_CST);
+    }
+
+    while (worker->conn_head)
+    {
+        connection_close(worker, worker->conn_head);
+    }
+    return NULL;
+}
+
+// ===== RELOADING =====
+
+// Wait until no worker can still be using a program that was just replaced:
+// each one has finished the batch it was handling, if any. Workers waiting
+// for events hold nothing, and their next batch loads the new program.
+static void wait_for_workers(HTTPServer *server)
+{
+    for (int i = 0; i < server->worker_count; i++)
+    {
+        unsigned long *epoch = &server->workers[i].epoch;
+        unsigned long seen = __atomic_load_n(epoch, __ATOMIC_SEQ_CST);
+        while ((seen & 1) && __atomic_load_n(epoch, __ATOMIC_SEQ_CST) == seen)
+            usleep(1000);
+    }
+}
+
+// Load the file again and swap it in. Everything slow happens before the
+// swap, so requests keep being answered from the old version meanwhile;
+// if the new one doesn't load, the old one stays.
+static void reload_program(HTTPServer *server)
+{
+    LoadedProgram loaded;
+    if (program_load(server->path, &loaded) < 0)
+    {
+        fprintf(stderr, "Reloading %s failed; still serving the previous version\n", server->path);
+        return;
+    }
+
+    ServerProgram *program = program_create(server, loaded.ast, loaded.image, 1);
+    program_start(server, program);
+
+    ServerProgram *old = server->current;
+    __atomic_store_n(&server->current, program, __ATOMIC_SEQ_CST);
+    wait_for_workers(server);
+    program_free(old);
+
+    uint32_t routes = program->router->route_count;
+    printf("Reloaded %s (%u route%s)\n", server->path, routes, routes == 1 ? "" : "s");
+}
+
+// Read every queued inotify event; non-zero if one was for name
+static int drain_events(int fd, const char *name)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int matched = 0;
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        char *p = buf;
+        while (p < buf + len)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, name) == 0)
+                matched = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return matched;
+}
+
+// Reload thread. Watches the file's directory rather than the file, since
+// editors (and "webbubble compile") save by renaming a new file over the
+// old one, which a watch on the old file would never see.
+static void *reload_run(void *arg)
+{
+    HTTPServer *server = (HTTPServer *)arg;
+    const char *slash = strrchr(server->path, '/');
+    const char *name = slash ? slash + 1 : server->path;
+    char *dir = slash ? strndup(server->path, (size_t)(slash - server->path) + 1) : strdup(".");
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        perror("Cannot watch the program for changes");
+        if (fd >= 0)
+            close(fd);
+        free(dir);
+        return NULL;
+    }
+
+    while (server->running)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0 || !drain_events(fd, name))
+            continue;
+
+        // Let a save made of several writes finish before reading it
+        usleep(50 * 1000);
+        drain_events(fd, name);
+        reload_program(server);
+    }
+
+    close(fd);
+    free(dir);
+    return NULL;
+}
+
+// Worker 0 runs on the thread that started the server, normally the main
+// thread, whose stack is limited by RLIMIT_STACK; an unlimited one is
+// treated as WORKER_STACK_SIZE
+static size_t calling_thread_stack_size()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur < WORKER_STACK_SIZE)
+        return (size_t)limit.rlim_cur;
+    return WORKER_STACK_SIZE;
+}
+
+void http_server_start(HTTPServer *server)
+{
+    program_start(server, server->current);
+
+    server->workers = (HTTPWorker *)malloc(sizeof(HTTPWorker) * server->worker_count);
+    for (int i = 0; i < server->worker_count; i++)
+    {
+        HTTPWorker *worker = &server->workers[i];
+        worker->id = i;
+        worker->server = server;
+        worker->socket_fd = -1;
+        worker->epoll_fd = -1;
+        worker->interpreter = interpreter_init();
+        interpreter_set_max_call_depth(worker->interpreter, server->max_call_depth);
+        worker->program = NULL;
+        worker->epoch = 0;
+        worker->stack_size = i == 0 ? calling_thread_stack_size() : WORKER_STACK_SIZE;
+        worker->conn_head = NULL;
+        worker->conn_tail = NULL;
+        worker_listen(worker);
+    }
+
     printf("\n");
     printf("================================\n");
     printf("  WebBubble HTTP Server 🫧\n");
     printf("================================\n");
-    printf("Listening on http://localhost:%d\n", server->port);
+    printf("Listening on http://localhost:%d (%d worker%s)\n",
+           server->port, server->worker_count, server->worker_count == 1 ? "" : "s");
+    printf("Running routes on the %s\n",
+           runs_bytecode(server, server->current) ? "bytecode VM" : "tree-walking interpreter");
+    if (server->path && server->reload)
+        printf("Reloading %s when it changes\n", server->path);
     printf("Press Ctrl+C to stop\n\n");
 
     // Print available routes
+    ServerProgram *program = server->current;
     printf("Available routes:\n");
-    for (int i = 0; i < server->program->data.program.route_count; i++)
+    for (int i = 0; i < (int)program->router->route_count; i++)
     {
-        ASTNode *route = server->program->data.program.routes[i];
-        printf("  - http://localhost:%d%s\n", server->port, route->data.route.path);
+        int method;
+        const char *path = router_split_method(route_pattern(program, i), &method);
+        const char *cached = program->static_responses[i].bytes[0].len > 0 ? " (static)" : "";
+        if (method == ROUTER_METHOD_ANY)
+            printf("  - http://localhost:%d%s%s\n", server->port, path, cached);
+        else
+            printf("  - %s http://localhost:%d%s%s\n", router_method_name(method),
+                   server->port, path, cached);
     }
     printf("\n");
 
-    // Accept connections loop
-    while (1)
+    server->running = 1;
+
+    // Extra workers get their own threads with shutdown signals blocked, so
+    // SIGINT/SIGTERM are always delivered to the thread that called us
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    for (int i = 1; i < server->worker_count; i++)
     {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-
-        int client_fd = accept(server->socket_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0)
+        HTTPWorker *worker = &server->workers[i];
+        if (pthread_create(&worker->thread, &attr, worker_run, worker) != 0)
         {
-            perror("Accept failed");
-            continue;
+            perror("Failed to start worker thread");
+            exit(EXIT_FAILURE);
         }
+    }
+    pthread_attr_destroy(&attr);
+    int reloading = server->path && server->reload &&
+                    pthread_create(&server->reloader, NULL, reload_run, server) == 0;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
 
-        handle_client(server, client_fd);
+    // Worker 0 runs on the calling thread
+    worker_run(&server->workers[0]);
+
+    for (int i = 1; i < server->worker_count; i++)
+    {
+        pthread_join(server->workers[i].thread, NULL);
     }
+    if (reloading)
+        pthread_join(server->reloader, NULL);
 }
 
-void http_server_stop(HTTPServer *server)
+void http_server_print_cache_stats(HTTPServer *server)
 {
-    if (server->socket_fd >= 0)
+    if (!server->workers)
+        return;
+
+    ServerProgram *program = server->current;
+    size_t stride = static_hits_stride(program);
+    printf("Static response cache hits:\n");
+    for (int i = 0; i < (int)program->router->route_count; i++)
     {
-        close(server->socket_fd);
-        server->socket_fd = -1;
+        if (program->static_responses[i].bytes[0].len == 0)
+            continue;
+        unsigned long hits = 0;
+        for (int w = 0; w < server->worker_count; w++)
+        {
+            hits += program->static_hits[stride * w + i];
+        }
+        printf("  %-32s %lu\n", route_pattern(program, i), hits);
+    }
+
+    if (program->memo)
+    {
+        MemoStats stats;
+        memo_cache_stats(program->memo, &stats);
+        unsigned long calls = stats.hits + stats.misses;
+        printf("Memo function cache: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %zu entries\n",
+               stats.hits, stats.misses, calls ? 100.0 * stats.hits / calls : 0.0, stats.evictions,
+               stats.entries);
     }
-#ifdef _WIN32
-    WSACleanup();
-#endif
+}
+
+void http_server_stop(HTTPServer *server)
+{
+    // Only flips the flag: safe from a signal handler. Each worker leaves its
+    // loop within one epoll timeout and the sockets are closed by
+    // http_server_free.
+    server->running = 0;
 }
 
 // Expose execute_statement for HTTP server use
@@ -0,0 +1,471 @@
+#include "image.h"
+#include "bytebuffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_ALIGNMENT 8
+
+static const size_t section_sizes[IMAGE_SECTION_COUNT] = {
+    sizeof(Instruction),       // IMAGE_CODE
+    sizeof(double),            // IMAGE_NUMBERS
+    sizeof(uint32_t),          // IMAGE_STRINGS
+    1,                         // IMAGE_POOL
+    sizeof(BytecodeRoute),     // IMAGE_ROUTES
+    sizeof(BytecodeFunction),  // IMAGE_FUNCTIONS
+    sizeof(RouterNode),        // IMAGE_ROUTER_NODES
+    sizeof(RouterRoute),       // IMAGE_ROUTER_ROUTES
+    sizeof(RouterParam),       // IMAGE_ROUTER_PARAMS
+    1,                         // IMAGE_ROUTER_STRINGS
+};
+
+// FNV-1a over 64-bit words rather than bytes, so checking a large image
+// costs little next to mapping it. Sections are padded to whole words.
+static uint64_t image_checksum(const unsigned char *data, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// ===== WRITING =====
+
+static void append_section(ByteBuffer *buf, ImageHeader *header, ImageSectionId id,
+                           const void *data, size_t count)
+{
+    static const char padding[IMAGE_ALIGNMENT];
+
+    header->sections[id].offset = buf->len;
+    header->sections[id].count = count;
+    if (count > 0)
+        bytebuffer_append(buf, data, count * section_sizes[id]);
+    bytebuffer_append(buf, padding, (IMAGE_ALIGNMENT - buf->len % IMAGE_ALIGNMENT) % IMAGE_ALIGNMENT);
+}
+
+int image_write(const char *path, const BytecodeProgram *bytecode, const Router *router)
+{
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+
+    ByteBuffer buf;
+    bytebuffer_init(&buf);
+    bytebuffer_append(&buf, &header, sizeof(header)); // Filled in last
+
+    append_section(&buf, &header, IMAGE_CODE, bytecode->code, bytecode->code_len);
+    append_section(&buf, &header, IMAGE_NUMBERS, bytecode->numbers, bytecode->number_count);
+    append_section(&buf, &header, IMAGE_STRINGS, bytecode->strings, bytecode->string_count);
+    append_section(&buf, &header, IMAGE_POOL, bytecode->pool, bytecode->pool_len);
+    append_section(&buf, &header, IMAGE_ROUTES, bytecode->routes, bytecode->route_count);
+    append_section(&buf, &header, IMAGE_FUNCTIONS, bytecode->functions, bytecode->function_count);
+    append_section(&buf, &header, IMAGE_ROUTER_NODES, router->nodes, router->node_count);
+    append_section(&buf, &header, IMAGE_ROUTER_ROUTES, router->routes, router->route_count);
+    append_section(&buf, &header, IMAGE_ROUTER_PARAMS, router->params, router->param_count);
+    append_section(&buf, &header, IMAGE_ROUTER_STRINGS, router->strings, router->strings_len);
+
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.opcode_count = OP_COUNT;
+    header.header_size = sizeof(header);
+    for (int i = 0; i < IMAGE_SECTION_COUNT; i++)
+    {
+        header.element_sizes[i] = (uint32_t)section_sizes[i];
+    }
+    header.size = buf.len;
+    header.checksum = image_checksum((unsigned char *)buf.data + sizeof(header), buf.len - sizeof(header));
+    memcpy(buf.data, &header, sizeof(header));
+
+    // Write beside the target and rename over it, so a server loading the
+    // image never sees it half written
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = (char *)malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    int ok = 0;
+    FILE *file = fopen(tmp, "wb");
+    if (file)
+    {
+        ok = fwrite(buf.data, 1, buf.len, file) == buf.len;
+        ok = fclose(file) == 0 && ok;
+        ok = ok && rename(tmp, path) == 0;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Cannot write image %s: %s\n", path, strerror(errno));
+        remove(tmp);
+    }
+
+    free(tmp);
+    bytebuffer_free(&buf);
+    return ok ? 0 : -1;
+}
+
+// ===== LOADING =====
+
+static const void *section(const ImageHeader *header, ImageSectionId id)
+{
+    return (const char *)header + header->sections[id].offset;
+}
+
+// Check that every index the VM and router follow without checking stays
+// inside the image. Instructions are checked by check_code.
+static const char *check_tables(const ImageHeader *header)
+{
+    const ImageSection *s = header->sections;
+    const uint32_t *strings = (const uint32_t *)section(header, IMAGE_STRINGS);
+    const char *pool = (const char *)section(header, IMAGE_POOL);
+    const BytecodeRoute *routes = (const BytecodeRoute *)section(header, IMAGE_ROUTES);
+    const BytecodeFunction *functions = (const BytecodeFunction *)section(header, IMAGE_FUNCTIONS);
+    const RouterNode *nodes = (const RouterNode *)section(header, IMAGE_ROUTER_NODES);
+    const RouterRoute *router_routes = (const RouterRoute *)section(header, IMAGE_ROUTER_ROUTES);
+    const RouterParam *params = (const RouterParam *)section(header, IMAGE_ROUTER_PARAMS);
+    const char *router_strings = (const char *)section(header, IMAGE_ROUTER_STRINGS);
+
+    if (s[IMAGE_POOL].count > 0 && pool[s[IMAGE_POOL].count - 1] != '\0')
+        return "string pool is not terminated";
+    for (uint64_t i = 0; i < s[IMAGE_STRINGS].count; i++)
+    {
+        if (strings[i] >= s[IMAGE_POOL].count)
+            return "string constant out of range";
+    }
+    for (uint64_t i = 0; i < s[IMAGE_ROUTES].count; i++)
+    {
+        if ((uint64_t)routes[i].code_start + routes[i].code_len > s[IMAGE_CODE].count ||
+            routes[i].max_stack > routes[i].code_len || routes[i].path >= s[IMAGE_STRINGS].count)
+            return "route out of range";
+    }
+    for (uint64_t i = 0; i < s[IMAGE_FUNCTIONS].count; i++)
+    {
+        if ((uint64_t)functions[i].code_start + functions[i].code_len > s[IMAGE_CODE].count ||
+            functions[i].max_stack > functions[i].code_len ||
+            functions[i].name >= s[IMAGE_STRINGS].count ||
+            functions[i].param_count > functions[i].slot_count)
+            return "function out of range";
+    }
+
+    if (s[IMAGE_ROUTER_ROUTES].count != s[IMAGE_ROUTES].count)
+        return "router and bytecode disagree on the routes";
+    if (s[IMAGE_ROUTER_STRINGS].count > 0 && router_strings[s[IMAGE_ROUTER_STRINGS].count - 1] != '\0')
+        return "router strings are not terminated";
+    for (uint64_t i = 0; i < s[IMAGE_ROUTER_NODES].count; i++)
+    {
+        const RouterNode *node = &nodes[i];
+        if ((uint64_t)node->first_child + node->child_count > s[IMAGE_ROUTER_NODES].count ||
+            (node->param_child >= 0 && (uint64_t)node->param_child >= s[IMAGE_ROUTER_NODES].count) ||
+            (uint64_t)node->label + node->label_len > s[IMAGE_ROUTER_STRINGS].count)
+            return "route trie node out of range";
+        for (int m = 0; m < ROUTER_METHOD_COUNT; m++)
+        {
+            if (node->routes[m] >= 0 && (uint64_t)node->routes[m] >= s[IMAGE_ROUTES].count)
+                return "route trie node out of range";
+        }
+    }
+    for (uint64_t i = 0; i < s[IMAGE_ROUTER_ROUTES].count; i++)
+    {
+        if ((uint64_t)router_routes[i].first_param + router_routes[i].param_count >
+            s[IMAGE_ROUTER_PARAMS].count)
+            return "route parameters out of range";
+        // A resolved route's parameters are stored straight into its frame
+        if (routes[i].resolved > 1 ||
+            (routes[i].resolved && router_routes[i].param_count > routes[i].slot_count))
+            return "route parameters out of range";
+    }
+    for (uint64_t i = 0; i < s[IMAGE_ROUTER_PARAMS].count; i++)
+    {
+        if ((uint64_t)params[i].name + params[i].name_len >= s[IMAGE_ROUTER_STRINGS].count)
+            return "route parameter name out of range";
+    }
+    return NULL;
+}
+
+// Check one route or function body: known opcodes, operands inside the
+// tables and the body's frame, jumps that land inside the body, and a last
+// instruction that never falls through past its end. One pass over the
+// code, far cheaper than the checksum.
+static const char *check_body(const ImageHeader *header, uint32_t start, uint32_t len,
+                              uint32_t slot_count)
+{
+    const ImageSection *s = header->sections;
+    const Instruction *code = (const Instruction *)section(header, IMAGE_CODE);
+
+    if (len == 0)
+        return "empty code body";
+    for (uint32_t i = start; i < start + len; i++)
+    {
+        Instruction ins = code[i];
+        uint64_t arg = INSTR_ARG(ins);
+        switch (INSTR_OP(ins))
+        {
+        case OP_PUSH_STRING:
+        case OP_LOAD_NAME:
+        case OP_STORE_NAME:
+        case OP_APPEND_NAME:
+        case OP_CALL_MISSING:
+            if (arg >= s[IMAGE_STRINGS].count)
+                return "instruction operand out of range";
+            break;
+        case OP_PUSH_NUMBER:
+            if (arg >= s[IMAGE_NUMBERS].count)
+                return "instruction operand out of range";
+            break;
+        case OP_LOAD:
+        case OP_STORE:
+            if (arg >= slot_count)
+                return "instruction operand out of range";
+            break;
+        case OP_BINARY:
+            if (arg > BINOP_UNKNOWN)
+                return "instruction operand out of range";
+            break;
+        case OP_CALL:
+        case OP_CALL_MEMO:
+        case OP_TAILCALL:
+            if (arg >= s[IMAGE_FUNCTIONS].count)
+                return "instruction operand out of range";
+            break;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        {
+            int64_t target = (int64_t)i + 1 + INSTR_SARG(ins);
+            if (target < (int64_t)start || target >= (int64_t)start + len)
+                return "jump out of range";
+            break;
+        }
+        default:
+            if (INSTR_OP(ins) >= OP_COUNT)
+                return "unknown opcode";
+            break;
+        }
+    }
+
+    int last = (int)INSTR_OP(code[start + len - 1]);
+    if (last != OP_RETURN && last != OP_HALT && last != OP_JUMP)
+        return "code runs past the end of its body";
+    return NULL;
+}
+
+// The VM trusts a body's max_stack and never checks for underflow, so
+// follow every path through the body from its start, counting operands with
+// the compiler's rules (bytecode_stack_effect). No instruction may pop more
+// than the body has pushed or push past max_stack, and every path to an
+// instruction must get there with the same depth. depth and pending are
+// scratch space with an entry per instruction of the image. Run after
+// check_body, which keeps every operand and jump in range.
+static const char *check_stack(const ImageHeader *header, uint32_t start, uint32_t len,
+                               uint32_t max_stack, uint32_t *depth, uint32_t *pending)
+{
+    const Instruction *code = (const Instruction *)section(header, IMAGE_CODE);
+    const BytecodeFunction *functions = (const BytecodeFunction *)section(header, IMAGE_FUNCTIONS);
+
+    // UINT32_MAX marks instructions no path has reached yet
+    memset(depth + start, 0xff, sizeof(uint32_t) * len);
+    depth[start] = 0;
+    pending[0] = start;
+    uint32_t pending_count = 1;
+
+    while (pending_count > 0)
+    {
+        uint32_t i = pending[--pending_count];
+        Instruction ins = code[i];
+        uint32_t pops, pushes;
+        bytecode_stack_effect(ins, functions, &pops, &pushes);
+        if (depth[i] < pops)
+            return "operand stack underflow";
+        uint32_t after = depth[i] - pops + pushes;
+        if (after > max_stack)
+            return "operand stack deeper than max_stack";
+
+        uint32_t next[2];
+        int next_count = 0;
+        switch (INSTR_OP(ins))
+        {
+        case OP_RETURN:
+        case OP_HALT:
+        case OP_TAILCALL:
+            break;
+        case OP_JUMP:
+            next[next_count++] = (uint32_t)((int64_t)i + 1 + INSTR_SARG(ins));
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            next[next_count++] = i + 1;
+            next[next_count++] = (uint32_t)((int64_t)i + 1 + INSTR_SARG(ins));
+            break;
+        default:
+            next[next_count++] = i + 1;
+            break;
+        }
+
+        for (int n = 0; n < next_count; n++)
+        {
+            if (depth[next[n]] == UINT32_MAX)
+            {
+                depth[next[n]] = after;
+                pending[pending_count++] = next[n];
+            }
+            else if (depth[next[n]] != after)
+            {
+                return "operand stack depth differs between paths";
+            }
+        }
+    }
+    return NULL;
+}
+
+static const char *check_code(const ImageHeader *header)
+{
+    const ImageSection *s = header->sections;
+    const BytecodeRoute *routes = (const BytecodeRoute *)section(header, IMAGE_ROUTES);
+    const BytecodeFunction *functions = (const BytecodeFunction *)section(header, IMAGE_FUNCTIONS);
+    size_t code_len = s[IMAGE_CODE].count > 0 ? s[IMAGE_CODE].count : 1;
+    uint32_t *depth = (uint32_t *)malloc(sizeof(uint32_t) * code_len);
+    uint32_t *pending = (uint32_t *)malloc(sizeof(uint32_t) * code_len);
+    const char *problem = NULL;
+
+    for (uint64_t i = 0; i < s[IMAGE_ROUTES].count && !problem; i++)
+    {
+        const BytecodeRoute *route = &routes[i];
+        problem = check_body(header, route->code_start, route->code_len, route->slot_count);
+        if (!problem)
+            problem = check_stack(header, route->code_start, route->code_len, route->max_stack,
+                                  depth, pending);
+    }
+    for (uint64_t i = 0; i < s[IMAGE_FUNCTIONS].count && !problem; i++)
+    {
+        const BytecodeFunction *function = &functions[i];
+        problem = check_body(header, function->code_start, function->code_len,
+                             function->slot_count);
+        if (!problem)
+            problem = check_stack(header, function->code_start, function->code_len,
+                                  function->max_stack, depth, pending);
+    }
+
+    free(depth);
+    free(pending);
+    return problem;
+}
+
+// Returns what is wrong with the image, or NULL if it can be used
+static const char *check_image(const ImageHeader *header, size_t size)
+{
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0)
+        return "not a WebBubble image";
+    if (header->version != IMAGE_VERSION || header->byte_order != IMAGE_BYTE_ORDER ||
+        header->opcode_count != OP_COUNT || header->header_size != sizeof(ImageHeader))
+        return "written by an incompatible version; compile it again";
+    for (int i = 0; i < IMAGE_SECTION_COUNT; i++)
+    {
+        if (header->element_sizes[i] != section_sizes[i])
+            return "written by an incompatible version; compile it again";
+    }
+    if (header->size != size)
+        return "truncated";
+
+    for (int i = 0; i < IMAGE_SECTION_COUNT; i++)
+    {
+        const ImageSection *s = &header->sections[i];
+        if (s->offset < sizeof(ImageHeader) || s->offset > size || s->offset % IMAGE_ALIGNMENT != 0 ||
+            s->count > (size - s->offset) / section_sizes[i] || s->count > UINT32_MAX)
+            return "section out of range";
+    }
+
+    if (image_checksum((const unsigned char *)header + sizeof(ImageHeader), size - sizeof(ImageHeader)) !=
+        header->checksum)
+        return "checksum mismatch";
+    const char *problem = check_tables(header);
+    return problem ? problem : check_code(header);
+}
+
+ProgramImage *image_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open image %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ImageHeader))
+    {
+        close(fd);
+        fprintf(stderr, "Cannot load image %s: not a WebBubble image\n", path);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map image %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    return image_open_mapping(path, data, size);
+}
+
+ProgramImage *image_open_mapping(const char *path, void *data, size_t size)
+{
+    const ImageHeader *header = (const ImageHeader *)data;
+    const char *problem = size < sizeof(ImageHeader) ? "not a WebBubble image"
+                                                     : check_image(header, size);
+    if (problem)
+    {
+        fprintf(stderr, "Cannot load image %s: %s\n", path, problem);
+        munmap(data, size);
+        return NULL;
+    }
+
+    // The structs are views of the mapping; the casts drop const only
+    // because they are shared with compiled programs, which own theirs
+    ProgramImage *image = (ProgramImage *)calloc(1, sizeof(ProgramImage));
+    image->data = data;
+    image->size = size;
+
+    const ImageSection *s = header->sections;
+    BytecodeProgram *bytecode = &image->bytecode;
+    bytecode->code = (Instruction *)section(header, IMAGE_CODE);
+    bytecode->code_len = (uint32_t)s[IMAGE_CODE].count;
+    bytecode->numbers = (double *)section(header, IMAGE_NUMBERS);
+    bytecode->number_count = (uint32_t)s[IMAGE_NUMBERS].count;
+    bytecode->strings = (uint32_t *)section(header, IMAGE_STRINGS);
+    bytecode->string_count = (uint32_t)s[IMAGE_STRINGS].count;
+    bytecode->pool = (char *)section(header, IMAGE_POOL);
+    bytecode->pool_len = (uint32_t)s[IMAGE_POOL].count;
+    bytecode->routes = (BytecodeRoute *)section(header, IMAGE_ROUTES);
+    bytecode->route_count = (uint32_t)s[IMAGE_ROUTES].count;
+    bytecode->functions = (BytecodeFunction *)section(header, IMAGE_FUNCTIONS);
+    bytecode->function_count = (uint32_t)s[IMAGE_FUNCTIONS].count;
+
+    Router *router = &image->router;
+    router->nodes = (RouterNode *)section(header, IMAGE_ROUTER_NODES);
+    router->node_count = (uint32_t)s[IMAGE_ROUTER_NODES].count;
+    router->routes = (RouterRoute *)section(header, IMAGE_ROUTER_ROUTES);
+    router->route_count = (uint32_t)s[IMAGE_ROUTER_ROUTES].count;
+    router->params = (RouterParam *)section(header, IMAGE_ROUTER_PARAMS);
+    router->param_count = (uint32_t)s[IMAGE_ROUTER_PARAMS].count;
+    router->strings = (char *)section(header, IMAGE_ROUTER_STRINGS);
+    router->strings_len = (uint32_t)s[IMAGE_ROUTER_STRINGS].count;
+
+    return image;
+}
+
+void image_close(ProgramImage *image)
+{
+    if (!image)
+        return;
+    munmap(image->data, image->size);
+    free(image);
+}
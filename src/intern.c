@@ -0,0 +1,88 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INITIAL_CAPACITY 256
+
+static uint32_t hash_string(const char *str, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void intern_init(InternTable *table, Arena *arena)
+{
+    table->arena = arena;
+    table->capacity = INTERN_INITIAL_CAPACITY;
+    table->count = 0;
+    table->slots = (char **)calloc(table->capacity, sizeof(char *));
+    table->hashes = (uint32_t *)malloc(sizeof(uint32_t) * table->capacity);
+}
+
+void intern_free(InternTable *table)
+{
+    free(table->slots);
+    free(table->hashes);
+    table->slots = NULL;
+    table->hashes = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+// Double the table, keeping it at most half full so probes stay short
+static void grow(InternTable *table)
+{
+    size_t capacity = table->capacity * 2;
+    char **slots = (char **)calloc(capacity, sizeof(char *));
+    uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * capacity);
+
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (!table->slots[i])
+            continue;
+        size_t j = table->hashes[i] & (capacity - 1);
+        while (slots[j])
+            j = (j + 1) & (capacity - 1);
+        slots[j] = table->slots[i];
+        hashes[j] = table->hashes[i];
+    }
+
+    free(table->slots);
+    free(table->hashes);
+    table->slots = slots;
+    table->hashes = hashes;
+    table->capacity = capacity;
+}
+
+char *intern(InternTable *table, const char *str, size_t len)
+{
+    uint32_t hash = hash_string(str, len);
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+
+    while (table->slots[i])
+    {
+        char *existing = table->slots[i];
+        if (table->hashes[i] == hash && strncmp(existing, str, len) == 0 && existing[len] == '\0')
+            return existing;
+        i = (i + 1) & mask;
+    }
+
+    char *copy = arena_strndup(table->arena, str, len);
+    table->slots[i] = copy;
+    table->hashes[i] = hash;
+    if (++table->count * 2 > table->capacity)
+        grow(table);
+    return copy;
+}
+
+char *intern_cstr(InternTable *table, const char *str)
+{
+    return intern(table, str, strlen(str));
+}
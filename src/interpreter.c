@@ -1,4 +1,6 @@
 #include "interpreter.h"
+#include "memo.h"
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -9,33 +11,90 @@ Value value_create_string(const char *str)
 {
     Value val;
     val.type = VAL_STRING;
+    val.borrowed = 0;
     val.data.string = strdup(str);
     return val;
 }
 
+Value value_create_string_len(const char *str, size_t len)
+{
+    Value val;
+    val.type = VAL_STRING;
+    val.borrowed = 0;
+    val.data.string = strndup(str, len);
+    return val;
+}
+
+Value value_create_arena_string(Arena *arena, const char *str, size_t len)
+{
+    Value val;
+    val.type = VAL_STRING;
+    val.borrowed = 1;
+    val.data.string = arena_strndup(arena, str, len);
+    return val;
+}
+
+// String value pointing at memory that outlives it (an AST literal or a
+// string already in the arena)
+Value value_borrow_string(char *str)
+{
+    Value val;
+    val.type = VAL_STRING;
+    val.borrowed = 1;
+    val.data.string = str;
+    return val;
+}
+
 Value value_create_number(double num)
 {
     Value val;
     val.type = VAL_NUMBER;
+    val.borrowed = 0;
     val.data.number = num;
     return val;
 }
 
+Value value_create_bool(int boolean)
+{
+    Value val;
+    val.type = VAL_BOOL;
+    val.borrowed = 0;
+    val.data.boolean = boolean;
+    return val;
+}
+
 Value value_create_null()
 {
     Value val;
     val.type = VAL_NULL;
+    val.borrowed = 0;
     return val;
 }
 
 void value_free(Value *val)
 {
-    if (val->type == VAL_STRING && val->data.string)
+    if (val->type == VAL_STRING && val->data.string && !val->borrowed)
     {
         free(val->data.string);
     }
 }
 
+// false, 0, "" and null are false; everything else is true
+int value_truthy(Value *val)
+{
+    switch (val->type)
+    {
+    case VAL_BOOL:
+        return val->data.boolean;
+    case VAL_NUMBER:
+        return val->data.number != 0;
+    case VAL_STRING:
+        return val->data.string[0] != '\0';
+    default:
+        return 0;
+    }
+}
+
 void value_print(Value *val, FILE *output)
 {
     switch (val->type)
@@ -55,6 +114,25 @@ void value_print(Value *val, FILE *output)
     }
 }
 
+void value_write(Value *val, ByteBuffer *buf)
+{
+    switch (val->type)
+    {
+    case VAL_STRING:
+        bytebuffer_append_str(buf, val->data.string);
+        break;
+    case VAL_NUMBER:
+        bytebuffer_appendf(buf, "%g", val->data.number);
+        break;
+    case VAL_BOOL:
+        bytebuffer_append_str(buf, val->data.boolean ? "true" : "false");
+        break;
+    case VAL_NULL:
+        bytebuffer_append_str(buf, "null");
+        break;
+    }
+}
+
 char *value_to_string(Value *val)
 {
     char buffer[256];
@@ -73,10 +151,63 @@ char *value_to_string(Value *val)
     return strdup("");
 }
 
+// Text of a value without allocating; numbers are formatted into scratch
+static const char *value_text(Value *val, char scratch[32], size_t *len)
+{
+    const char *text;
+    switch (val->type)
+    {
+    case VAL_STRING:
+        text = val->data.string;
+        break;
+    case VAL_NUMBER:
+        *len = (size_t)snprintf(scratch, 32, "%g", val->data.number);
+        return scratch;
+    case VAL_BOOL:
+        text = val->data.boolean ? "true" : "false";
+        break;
+    default:
+        text = "null";
+        break;
+    }
+    *len = strlen(text);
+    return text;
+}
+
+// Concatenate the text of two values into a new arena string
+Value value_concat(Arena *arena, Value *left, Value *right)
+{
+    char left_scratch[32], right_scratch[32];
+    size_t left_len, right_len;
+    const char *left_text = value_text(left, left_scratch, &left_len);
+    const char *right_text = value_text(right, right_scratch, &right_len);
+
+    char *concat = (char *)arena_alloc(arena, left_len + right_len + 1);
+    memcpy(concat, left_text, left_len);
+    memcpy(concat + left_len, right_text, right_len);
+    concat[left_len + right_len] = '\0';
+    return value_borrow_string(concat);
+}
+
 // ===== VARIABLE STORAGE =====
 
+// Move a heap-owned string into the arena so the value can be stored; a
+// value it replaces is simply abandoned there until the next reset
+static Value value_to_arena(Interpreter *interp, Value value)
+{
+    if (value.type == VAL_STRING && !value.borrowed)
+    {
+        char *copy = arena_strdup(&interp->arena, value.data.string);
+        value_free(&value);
+        value = value_borrow_string(copy);
+    }
+    return value;
+}
+
 void set_variable(Interpreter *interp, const char *name, Value value)
 {
+    value = value_to_arena(interp, value);
+
     // Check if variable already exists
     Variable *var = interp->variables;
     while (var)
@@ -84,7 +215,6 @@ void set_variable(Interpreter *interp, const char *name, Value value)
         if (strcmp(var->name, name) == 0)
         {
             // Update existing variable
-            value_free(&var->value);
             var->value = value;
             return;
         }
@@ -92,14 +222,14 @@ void set_variable(Interpreter *interp, const char *name, Value value)
     }
 
     // Create new variable
-    Variable *new_var = (Variable *)malloc(sizeof(Variable));
-    new_var->name = strdup(name);
+    Variable *new_var = (Variable *)arena_alloc(&interp->arena, sizeof(Variable));
+    new_var->name = arena_strdup(&interp->arena, name);
     new_var->value = value;
     new_var->next = interp->variables;
     interp->variables = new_var;
 }
 
-static Value *get_variable(Interpreter *interp, const char *name)
+Value *get_variable(Interpreter *interp, const char *name)
 {
     Variable *var = interp->variables;
     while (var)
@@ -113,37 +243,229 @@ static Value *get_variable(Interpreter *interp, const char *name)
     return NULL;
 }
 
+// ===== OPERATORS =====
+
+// Number a value stands for: numbers, and strings that are entirely a
+// number (path parameters, say)
+static int value_as_number(Value *val, double *out)
+{
+    if (val->type == VAL_NUMBER)
+    {
+        *out = val->data.number;
+        return 1;
+    }
+    if (val->type != VAL_STRING || val->data.string[0] == '\0')
+        return 0;
+
+    char *end;
+    *out = strtod(val->data.string, &end);
+    return *end == '\0';
+}
+
+// Shared by the tree-walker and the VM. String results live in arena.
+Value value_binary_op(Arena *arena, BinaryOperator op, Value *left, Value *right)
+{
+    // Arithmetic and ordering accept numeric strings; "+" only does so when
+    // the other side is a number, and otherwise concatenates
+    double a, b;
+    int numbers = value_as_number(left, &a) && value_as_number(right, &b);
+
+    switch (op)
+    {
+    case BINOP_ADD:
+        if (numbers && (left->type == VAL_NUMBER || right->type == VAL_NUMBER))
+            return value_create_number(a + b);
+        if (left->type == VAL_STRING || right->type == VAL_STRING)
+            return value_concat(arena, left, right);
+        break;
+    case BINOP_SUB:
+        if (numbers)
+            return value_create_number(a - b);
+        break;
+    case BINOP_MUL:
+        if (numbers)
+            return value_create_number(a * b);
+        break;
+    case BINOP_DIV:
+        if (numbers)
+        {
+            if (b != 0)
+                return value_create_number(a / b);
+            fprintf(stderr, "Runtime error: Division by zero\n");
+        }
+        break;
+    case BINOP_LT:
+        if (numbers)
+            return value_create_bool(a < b);
+        break;
+    case BINOP_GT:
+        if (numbers)
+            return value_create_bool(a > b);
+        break;
+    case BINOP_LTE:
+        if (numbers)
+            return value_create_bool(a <= b);
+        break;
+    case BINOP_GTE:
+        if (numbers)
+            return value_create_bool(a >= b);
+        break;
+    case BINOP_EQ:
+    case BINOP_NEQ:
+    {
+        int equal = 0;
+        if (left->type == VAL_NUMBER && right->type == VAL_NUMBER)
+            equal = left->data.number == right->data.number;
+        else if (left->type == VAL_STRING && right->type == VAL_STRING)
+            equal = strcmp(left->data.string, right->data.string) == 0;
+        return value_create_bool(op == BINOP_EQ ? equal : !equal);
+    }
+    case BINOP_AND:
+        return value_create_bool(value_truthy(left) && value_truthy(right));
+    case BINOP_OR:
+        return value_create_bool(value_truthy(left) || value_truthy(right));
+    default:
+        break;
+    }
+    return value_create_null();
+}
+
 // ===== INTERPRETER CORE =====
 
 // Forward declarations
 static Value eval_expression(Interpreter *interp, ASTNode *node);
 void execute_statement(Interpreter *interp, ASTNode *node); // Not static - used by HTTP server
 
+// Evaluate a call's arguments into args[0..param_count). Missing ones are
+// null; extra ones are evaluated and dropped.
+static void evaluate_arguments(Interpreter *interp, ASTNode *call, ASTNode *function, Value *args)
+{
+    int param_count = function->data.function.param_count;
+    for (int i = 0; i < param_count; i++)
+    {
+        args[i] = value_create_null();
+    }
+    for (int i = 0; i < call->data.function_call.arg_count; i++)
+    {
+        Value arg = eval_expression(interp, call->data.function_call.args[i]);
+        if (i < param_count)
+            args[i] = value_to_arena(interp, arg);
+        else
+            value_free(&arg);
+    }
+}
+
+// Call a resolved function. Its frame goes on the value stack before the
+// arguments are evaluated straight into it, so calls made while evaluating
+// them stack above it. A "return g(...)" in the body hands back g with its
+// arguments just above the frame, and g then runs in the same frame.
+static Value call_function(Interpreter *interp, ASTNode *call)
+{
+    ASTNode *function = call->data.function_call.target;
+    if (interp->error)
+        return value_create_null();
+    if (!function)
+    {
+        fprintf(stderr, "Runtime error: Undefined function '%s'\n", call->data.function_call.name);
+        return value_create_null();
+    }
+
+    int size = function->data.function.slot_count;
+    if (interp->call_depth >= interp->max_call_depth)
+    {
+        interpreter_abort(interp, "Call depth limit (%d) exceeded calling '%s'",
+                          interp->max_call_depth, function->data.function.name);
+        return value_create_null();
+    }
+    if (interp->stack_top + size > interp->stack_size ||
+        (uintptr_t)__builtin_frame_address(0) < interp->c_stack_limit)
+    {
+        interpreter_abort(interp, "Out of stack space calling '%s'", function->data.function.name);
+        return value_create_null();
+    }
+
+    int base = interp->stack_top;
+    Value *frame = interp->stack + base;
+    for (int i = function->data.function.param_count; i < size; i++)
+    {
+        frame[i] = value_create_null();
+    }
+    interp->stack_top += size;
+    evaluate_arguments(interp, call, function, frame);
+
+    MemoKey *key = NULL;
+    if (function->data.function.memo && interp->memo && !interp->error)
+    {
+        Value cached;
+        key = memo_key_create(&interp->arena, (uint32_t)function->data.function.index, frame,
+                              function->data.function.param_count);
+        if (memo_cache_lookup(interp->memo, key, &interp->arena, &cached))
+        {
+            interp->stack_top = base;
+            return cached;
+        }
+    }
+
+    Value *caller_frame = interp->frame;
+    int caller_size = interp->frame_size;
+    interp->call_depth++;
+
+    while (1)
+    {
+        interp->frame = frame;
+        interp->frame_size = size;
+        execute_statement(interp, function->data.function.body);
+        if (!interp->tail_call)
+            break;
+
+        function = interp->tail_call;
+        interp->tail_call = NULL;
+        interp->returning = 0;
+
+        int param_count = function->data.function.param_count;
+        memmove(frame, frame + size, sizeof(Value) * param_count);
+        size = function->data.function.slot_count;
+        for (int i = param_count; i < size; i++)
+        {
+            frame[i] = value_create_null();
+        }
+        interp->stack_top = base + size;
+    }
+
+    Value result = interp->returning ? interp->return_value : value_create_null();
+    interp->returning = 0;
+    if (key && !interp->error)
+        memo_cache_store(interp->memo, key, &result);
+
+    interp->call_depth--;
+    interp->frame = caller_frame;
+    interp->frame_size = caller_size;
+    interp->stack_top = base;
+    return result;
+}
+
 // Evaluate an expression node and return its value
 static Value eval_expression(Interpreter *interp, ASTNode *node)
 {
     switch (node->type)
     {
     case AST_STRING:
-        return value_create_string(node->data.string.value);
+        return value_borrow_string(node->data.string.value);
 
     case AST_NUMBER:
         return value_create_number(node->data.number.value);
 
     case AST_IDENTIFIER:
     {
+        int slot = node->data.identifier.slot;
+        if (slot >= 0 && slot < interp->frame_size)
+            return interp->frame[slot];
+
         Value *var = get_variable(interp, node->data.identifier.name);
         if (var)
         {
-            // Return a copy
-            if (var->type == VAL_STRING)
-            {
-                return value_create_string(var->data.string);
-            }
-            else if (var->type == VAL_NUMBER)
-            {
-                return value_create_number(var->data.number);
-            }
+            // Variables are never modified in place, so strings can be shared
+            return *var;
         }
         fprintf(stderr, "Runtime error: Undefined variable '%s'\n",
                 node->data.identifier.name);
@@ -153,147 +475,47 @@ static Value eval_expression(Interpreter *interp, ASTNode *node)
     case AST_BLOCK:
     {
         // For blocks in HTML context, concatenate identifiers
-        Value result = value_create_string("");
+        Value result = value_borrow_string("");
         for (int i = 0; i < node->data.block.statement_count; i++)
         {
             ASTNode *stmt = node->data.block.statements[i];
             if (stmt->type == AST_IDENTIFIER)
             {
                 // Look up the variable and append it
-                Value *var = get_variable(interp, stmt->data.identifier.name);
+                int slot = stmt->data.identifier.slot;
+                Value *var = slot >= 0 && slot < interp->frame_size
+                                 ? &interp->frame[slot]
+                                 : get_variable(interp, stmt->data.identifier.name);
                 if (var)
-                {
-                    char *old = result.data.string;
-                    char *var_str = value_to_string(var);
-
-                    size_t new_len = strlen(old) + strlen(var_str) + 2;
-                    char *new_str = malloc(new_len);
-                    snprintf(new_str, new_len, "%s%s", old, var_str);
-
-                    free(old);
-                    free(var_str);
-                    result.data.string = new_str;
-                }
+                    result = value_concat(&interp->arena, &result, var);
             }
         }
         return result;
     }
 
+    case AST_FUNCTION_CALL:
+        return call_function(interp, node);
+
     case AST_BINARY_OP:
     {
-        Value left = eval_expression(interp, node->data.binary_op.left);
-        Value right = eval_expression(interp, node->data.binary_op.right);
-        Value result;
-
-        const char *op = node->data.binary_op.operator;
-
-        // Arithmetic operations
-        if (strcmp(op, "+") == 0)
-        {
-            if (left.type == VAL_STRING || right.type == VAL_STRING)
-            {
-                // String concatenation
-                char *left_str = value_to_string(&left);
-                char *right_str = value_to_string(&right);
-                size_t len = strlen(left_str) + strlen(right_str) + 1;
-                char *concat = malloc(len);
-                snprintf(concat, len, "%s%s", left_str, right_str);
-                result = value_create_string(concat);
-                free(concat);
-                free(left_str);
-                free(right_str);
-            }
-            else if (left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-            {
-                result = value_create_number(left.data.number + right.data.number);
-            }
-            else
-            {
-                result = value_create_null();
-            }
-        }
-        else if (strcmp(op, "-") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            result = value_create_number(left.data.number - right.data.number);
-        }
-        else if (strcmp(op, "*") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
+        BinaryOperator op = node->data.binary_op.op;
+        if (op == BINOP_AND || op == BINOP_OR)
         {
-            result = value_create_number(left.data.number * right.data.number);
-        }
-        else if (strcmp(op, "/") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            if (right.data.number != 0)
-            {
-                result = value_create_number(left.data.number / right.data.number);
-            }
-            else
-            {
-                fprintf(stderr, "Runtime error: Division by zero\n");
-                result = value_create_null();
-            }
-        }
-        // Comparison operations
-        else if (strcmp(op, "<") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            result.type = VAL_BOOL;
-            result.data.boolean = left.data.number < right.data.number;
-        }
-        else if (strcmp(op, ">") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            result.type = VAL_BOOL;
-            result.data.boolean = left.data.number > right.data.number;
-        }
-        else if (strcmp(op, "<=") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            result.type = VAL_BOOL;
-            result.data.boolean = left.data.number <= right.data.number;
-        }
-        else if (strcmp(op, ">=") == 0 && left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-        {
-            result.type = VAL_BOOL;
-            result.data.boolean = left.data.number >= right.data.number;
-        }
-        else if (strcmp(op, "==") == 0)
-        {
-            if (left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = left.data.number == right.data.number;
-            }
-            else if (left.type == VAL_STRING && right.type == VAL_STRING)
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = strcmp(left.data.string, right.data.string) == 0;
-            }
-            else
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = 0;
-            }
-        }
-        else if (strcmp(op, "!=") == 0)
-        {
-            if (left.type == VAL_NUMBER && right.type == VAL_NUMBER)
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = left.data.number != right.data.number;
-            }
-            else if (left.type == VAL_STRING && right.type == VAL_STRING)
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = strcmp(left.data.string, right.data.string) != 0;
-            }
-            else
-            {
-                result.type = VAL_BOOL;
-                result.data.boolean = 1;
-            }
-        }
-        else
-        {
-            result = value_create_null();
+            // Short-circuit: the right side only runs if it decides the result
+            Value left = eval_expression(interp, node->data.binary_op.left);
+            int truth = value_truthy(&left);
+            value_free(&left);
+            if (truth == (op == BINOP_OR))
+                return value_create_bool(truth);
+            Value right = eval_expression(interp, node->data.binary_op.right);
+            truth = value_truthy(&right);
+            value_free(&right);
+            return value_create_bool(truth);
         }
 
+        Value left = eval_expression(interp, node->data.binary_op.left);
+        Value right = eval_expression(interp, node->data.binary_op.right);
+        Value result = value_binary_op(&interp->arena, op, &left, &right);
         value_free(&left);
         value_free(&right);
         return result;
@@ -304,6 +526,43 @@ static Value eval_expression(Interpreter *interp, ASTNode *node)
     }
 }
 
+// Write a response value to the route's response, or to output when not
+// serving a request
+void interpreter_respond(Interpreter *interp, Value *value, int is_html)
+{
+    RouteResponse *response = interp->response;
+
+    if (response)
+    {
+        if (is_html)
+        {
+            response->content_type = STRVIEW_LITERAL("text/html");
+            bytebuffer_append_str(&response->body, "<html><body>");
+            value_write(value, &response->body);
+            bytebuffer_append_str(&response->body, "</body></html>\n");
+        }
+        else
+        {
+            response->content_type = STRVIEW_LITERAL("text/plain");
+            value_write(value, &response->body);
+            bytebuffer_append_str(&response->body, "\n");
+        }
+    }
+    else if (is_html)
+    {
+        fprintf(interp->output, "Content-Type: text/html\n\n");
+        fprintf(interp->output, "<html><body>");
+        value_print(value, interp->output);
+        fprintf(interp->output, "</body></html>\n");
+    }
+    else
+    {
+        fprintf(interp->output, "Content-Type: text/plain\n\n");
+        value_print(value, interp->output);
+        fprintf(interp->output, "\n");
+    }
+}
+
 // Execute a statement node
 void execute_statement(Interpreter *interp, ASTNode *node)
 {
@@ -312,38 +571,101 @@ void execute_statement(Interpreter *interp, ASTNode *node)
     case AST_ASSIGNMENT:
     {
         Value value = eval_expression(interp, node->data.assignment.value);
-        set_variable(interp, node->data.assignment.name, value);
+        int slot = node->data.assignment.slot;
+        if (slot >= 0 && slot < interp->frame_size)
+            interp->frame[slot] = value_to_arena(interp, value);
+        else
+            set_variable(interp, node->data.assignment.name, value);
         break;
     }
 
     case AST_RESPONSE:
     {
         Value value = eval_expression(interp, node->data.response.value);
+        if (!interp->error)
+            interpreter_respond(interp, &value, node->data.response.is_html);
+        value_free(&value);
+        break;
+    }
 
-        if (node->data.response.is_html)
+    case AST_BLOCK:
+    {
+        for (int i = 0; i < node->data.block.statement_count && !interp->returning && !interp->error;
+             i++)
         {
-            fprintf(interp->output, "Content-Type: text/html\n\n");
-            fprintf(interp->output, "<html><body>");
-            value_print(&value, interp->output);
-            fprintf(interp->output, "</body></html>\n");
+            execute_statement(interp, node->data.block.statements[i]);
         }
-        else
+        break;
+    }
+
+    case AST_IF:
+    {
+        Value condition = eval_expression(interp, node->data.if_stmt.condition);
+        int truth = value_truthy(&condition);
+        value_free(&condition);
+        if (truth)
+            execute_statement(interp, node->data.if_stmt.then_branch);
+        else if (node->data.if_stmt.else_branch)
+            execute_statement(interp, node->data.if_stmt.else_branch);
+        break;
+    }
+
+    case AST_WHILE:
+    {
+        while (!interp->returning && !interp->error)
         {
-            fprintf(interp->output, "Content-Type: text/plain\n\n");
-            value_print(&value, interp->output);
-            fprintf(interp->output, "\n");
+            Value condition = eval_expression(interp, node->data.while_stmt.condition);
+            int truth = value_truthy(&condition);
+            value_free(&condition);
+            if (!truth)
+                break;
+            execute_statement(interp, node->data.while_stmt.body);
         }
-
-        value_free(&value);
         break;
     }
 
-    case AST_BLOCK:
+    case AST_RETURN:
     {
-        for (int i = 0; i < node->data.block.statement_count; i++)
+        ASTNode *call = node->data.return_stmt.value;
+        if (call && call->type == AST_FUNCTION_CALL && call->data.function_call.target &&
+            !call->data.function_call.target->data.function.memo && interp->call_depth > 0)
         {
-            execute_statement(interp, node->data.block.statements[i]);
+            // Tail call: leave the arguments just above this frame for
+            // call_function, which reuses the frame for the callee. A memo
+            // function is called normally so its result can be cached.
+            ASTNode *target = call->data.function_call.target;
+            int param_count = target->data.function.param_count;
+            int base = (int)(interp->frame - interp->stack);
+            if (interp->stack_top + param_count > interp->stack_size ||
+                base + target->data.function.slot_count > interp->stack_size)
+            {
+                interpreter_abort(interp, "Out of stack space calling '%s'", target->data.function.name);
+                break;
+            }
+
+            Value *args = interp->stack + interp->stack_top;
+            interp->stack_top += param_count;
+            evaluate_arguments(interp, call, target, args);
+            interp->stack_top -= param_count;
+            if (!interp->error)
+                interp->tail_call = target;
+            interp->returning = 1;
+            break;
         }
+
+        // Also ends a route early when used outside a function
+        Value value = node->data.return_stmt.value
+                          ? eval_expression(interp, node->data.return_stmt.value)
+                          : value_create_null();
+        interp->return_value = value_to_arena(interp, value);
+        interp->returning = 1;
+        break;
+    }
+
+    case AST_FUNCTION_CALL:
+    {
+        Value value = call_function(interp, node);
+        value_free(&value);
         break;
     }
 
@@ -357,6 +679,7 @@ static void execute_route(Interpreter *interp, ASTNode *route)
 {
     fprintf(interp->output, "\n=== Executing Route: %s ===\n",
             route->data.route.path);
+    interpreter_enter_route(interp, route);
     execute_statement(interp, route->data.route.body);
 }
 
@@ -374,25 +697,100 @@ static void execute_program(Interpreter *interp, ASTNode *program)
 Interpreter *interpreter_init()
 {
     Interpreter *interp = (Interpreter *)malloc(sizeof(Interpreter));
+    interp->frame = NULL;
+    interp->frame_size = 0;
+    interp->stack = (Value *)malloc(sizeof(Value) * INTERPRETER_STACK_SLOTS);
+    interp->stack_size = INTERPRETER_STACK_SLOTS;
+    interp->stack_top = 0;
+    interp->call_depth = 0;
+    interp->max_call_depth = INTERPRETER_MAX_CALL_DEPTH;
+    interp->c_stack_limit = 0;
+    interp->calls = (CallFrame *)malloc(sizeof(CallFrame) * INTERPRETER_MAX_CALL_DEPTH);
+    interp->returning = 0;
+    interp->tail_call = NULL;
+    interp->error = NULL;
+    interp->memo = NULL;
     interp->variables = NULL;
+    arena_init(&interp->arena, 0);
     interp->output = stdout;
+    interp->response = NULL;
     return interp;
 }
 
 void interpreter_free(Interpreter *interp)
 {
-    // Free all variables
-    Variable *var = interp->variables;
-    while (var)
+    arena_free(&interp->arena);
+    free(interp->stack);
+    free(interp->calls);
+    free(interp);
+}
+
+void interpreter_set_max_call_depth(Interpreter *interp, int depth)
+{
+    interp->max_call_depth = depth > 0 ? depth : 1;
+    interp->calls = (CallFrame *)realloc(interp->calls, sizeof(CallFrame) * interp->max_call_depth);
+}
+
+void interpreter_set_c_stack(Interpreter *interp, size_t bytes)
+{
+    // Stacks grow down on every platform the server runs on
+    uintptr_t base = (uintptr_t)__builtin_frame_address(0);
+    interp->c_stack_limit = base > bytes ? base - bytes : 0;
+}
+
+void interpreter_abort(Interpreter *interp, const char *format, ...)
+{
+    if (interp->error)
+        return; // Keep the first error
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(stderr, "Runtime error: %s\n", message);
+    interp->error = arena_strdup(&interp->arena, message);
+}
+
+void interpreter_reset(Interpreter *interp)
+{
+    interp->frame = NULL;
+    interp->frame_size = 0;
+    interp->stack_top = 0;
+    interp->call_depth = 0;
+    interp->returning = 0;
+    interp->tail_call = NULL;
+    interp->error = NULL;
+    interp->variables = NULL;
+    arena_reset(&interp->arena);
+}
+
+Value *interpreter_enter_route(Interpreter *interp, ASTNode *route)
+{
+    return interpreter_enter_frame(interp, route->data.route.slot_count);
+}
+
+Value *interpreter_enter_frame(Interpreter *interp, int size)
+{
+    if (size > interp->stack_size)
     {
-        Variable *next = var->next;
-        free(var->name);
-        value_free(&var->value);
-        free(var);
-        var = next;
+        // Only a route with more variables than the whole stack gets here
+        interp->stack_size = size + INTERPRETER_STACK_SLOTS;
+        interp->stack = (Value *)realloc(interp->stack, sizeof(Value) * interp->stack_size);
     }
-
-    free(interp);
+    interp->frame = interp->stack;
+    interp->frame_size = size;
+    interp->stack_top = size;
+    interp->call_depth = 0;
+    interp->returning = 0;
+    interp->tail_call = NULL;
+    interp->error = NULL;
+    for (int i = 0; i < size; i++)
+    {
+        interp->frame[i] = value_create_null();
+    }
+    return interp->frame;
 }
 
 void interpreter_execute(Interpreter *interp, ASTNode *ast)
@@ -406,3 +804,27 @@ void interpreter_execute(Interpreter *interp, ASTNode *ast)
         fprintf(stderr, "Interpreter error: Expected program node\n");
     }
 }
+
+// ===== ROUTE RESPONSE =====
+
+void route_response_init(RouteResponse *response)
+{
+    response->status_code = 200;
+    response->content_type = STRVIEW_LITERAL("text/plain");
+    bytebuffer_init(&response->headers);
+    bytebuffer_init(&response->body);
+}
+
+void route_response_reset(RouteResponse *response)
+{
+    response->status_code = 200;
+    response->content_type = STRVIEW_LITERAL("text/plain");
+    bytebuffer_reset(&response->headers);
+    bytebuffer_reset(&response->body);
+}
+
+void route_response_free(RouteResponse *response)
+{
+    bytebuffer_free(&response->headers);
+    bytebuffer_free(&response->body);
+}
@@ -1,33 +1,52 @@
 #include "lexer.h"
+#include <stdarg.h>
 
 // Helper function to advance the lexer position
 static void advance(Lexer *lexer)
 {
-    if (lexer->current_char == '\n')
+    if (*lexer->cursor == '\n')
     {
         lexer->line++;
-        lexer->column = 0;
-    }
-    else
-    {
-        lexer->column++;
+        lexer->line_start = lexer->cursor + 1;
     }
+    lexer->cursor++;
+}
 
-    lexer->position++;
-    if (lexer->position < strlen(lexer->source))
-    {
-        lexer->current_char = lexer->source[lexer->position];
-    }
+static int at_end(Lexer *lexer)
+{
+    return lexer->cursor >= lexer->end;
+}
+
+// Character at offset from the cursor, or '\0' past the end
+static char peek(Lexer *lexer, size_t offset)
+{
+    return lexer->cursor + offset < lexer->end ? lexer->cursor[offset] : '\0';
+}
+
+static int column(Lexer *lexer)
+{
+    return (int)(lexer->cursor - lexer->line_start);
+}
+
+// Report an error; line is 1-based and col 0-based, as in tokens
+static void lexer_error(Lexer *lexer, int line, int col, const char *format, ...)
+{
+    char message[DIAGNOSTIC_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (lexer->diagnostics)
+        diagnostics_add(lexer->diagnostics, line, col + 1, "%s", message);
     else
-    {
-        lexer->current_char = '\0';
-    }
+        fprintf(stderr, "%s at line %d, column %d\n", message, line, col + 1);
 }
 
 // Skip whitespace
 static void skip_whitespace(Lexer *lexer)
 {
-    while (lexer->current_char != '\0' && isspace(lexer->current_char))
+    while (!at_end(lexer) && isspace((unsigned char)*lexer->cursor))
     {
         advance(lexer);
     }
@@ -36,156 +55,121 @@ static void skip_whitespace(Lexer *lexer)
 // Skip single-line comments (// ...)
 static void skip_comment(Lexer *lexer)
 {
-    if (lexer->current_char == '/' && lexer->position + 1 < strlen(lexer->source) && lexer->source[lexer->position + 1] == '/')
-    {
-        // Skip until end of line
-        while (lexer->current_char != '\0' && lexer->current_char != '\n')
-        {
-            advance(lexer);
-        }
-    }
+    // A comment never contains a newline, so the line doesn't change
+    const char *newline = memchr(lexer->cursor, '\n', lexer->end - lexer->cursor);
+    lexer->cursor = newline ? newline : lexer->end;
 }
 
-// Create a new token
-static Token *token_create(TokenType type, const char *value, int line, int column)
+// Fill in a token whose text is [start, start + len); a NULL start means no
+// value. The text is copied, NUL-terminated, to the tokenizer's text buffer.
+static void token_init(Lexer *lexer, Token *token, TokenType type, const char *start, size_t len,
+                       int line, int column)
 {
-    Token *token = (Token *)malloc(sizeof(Token));
     token->type = type;
-    token->value = value ? strdup(value) : NULL;
+    token->value = NULL;
     token->line = line;
     token->column = column;
-    return token;
+    if (start)
+    {
+        token->value = lexer->text;
+        memcpy(lexer->text, start, len);
+        lexer->text[len] = '\0';
+        lexer->text += len + 1;
+    }
 }
 
 // Read a string literal
-static Token *read_string(Lexer *lexer)
+static void read_string(Lexer *lexer, Token *token)
 {
     int line = lexer->line;
-    int column = lexer->column;
-    char buffer[1024];
-    int i = 0;
+    int col = column(lexer);
 
     advance(lexer); // Skip opening quote
-
-    while (lexer->current_char != '\0' && lexer->current_char != '"')
+    const char *start = lexer->cursor;
+    while (!at_end(lexer) && *lexer->cursor != '"')
     {
-        if (i >= 1023)
-        {
-            fprintf(stderr, "String too long at line %d\n", line);
-            exit(1);
-        }
-        buffer[i++] = lexer->current_char;
         advance(lexer);
     }
 
-    if (lexer->current_char == '"')
+    if (at_end(lexer))
     {
-        advance(lexer); // Skip closing quote
-    }
-    else
-    {
-        fprintf(stderr, "Unterminated string at line %d\n", line);
-        exit(1);
+        lexer_error(lexer, line, col, "Unterminated string");
+        token_init(lexer, token, TOKEN_UNKNOWN, NULL, 0, line, col);
+        return;
     }
 
-    buffer[i] = '\0';
-    return token_create(TOKEN_STRING, buffer, line, column);
+    token_init(lexer, token, TOKEN_STRING, start, lexer->cursor - start, line, col);
+    advance(lexer); // Skip closing quote
 }
 
 // Read a number
-static Token *read_number(Lexer *lexer)
+static void read_number(Lexer *lexer, Token *token)
 {
-    int line = lexer->line;
-    int column = lexer->column;
-    char buffer[256];
-    int i = 0;
-
-    while (lexer->current_char != '\0' && (isdigit(lexer->current_char) || lexer->current_char == '.'))
+    const char *start = lexer->cursor;
+    while (!at_end(lexer) && (isdigit((unsigned char)*lexer->cursor) || *lexer->cursor == '.'))
     {
-        if (i >= 255)
-        {
-            fprintf(stderr, "Number too long at line %d\n", line);
-            exit(1);
-        }
-        buffer[i++] = lexer->current_char;
-        advance(lexer);
+        lexer->cursor++;
     }
-
-    buffer[i] = '\0';
-    return token_create(TOKEN_NUMBER, buffer, line, column);
+    token_init(lexer, token, TOKEN_NUMBER, start, lexer->cursor - start, lexer->line,
+               (int)(start - lexer->line_start));
 }
 
+typedef struct {
+    const char *word;
+    size_t len;
+    TokenType type;
+} Keyword;
+
+static const Keyword keywords[] = {
+    {"route", 5, TOKEN_ROUTE},
+    {"response", 8, TOKEN_RESPONSE},
+    {"html", 4, TOKEN_HTML},
+    {"if", 2, TOKEN_IF},
+    {"else", 4, TOKEN_ELSE},
+    {"while", 5, TOKEN_WHILE},
+    {"for", 3, TOKEN_FOR},
+    {"function", 8, TOKEN_FUNCTION},
+    {"return", 6, TOKEN_RETURN},
+};
+
 // Read an identifier or keyword
-static Token *read_identifier(Lexer *lexer)
+static void read_identifier(Lexer *lexer, Token *token)
 {
-    int line = lexer->line;
-    int column = lexer->column;
-    char buffer[256];
-    int i = 0;
-
-    while (lexer->current_char != '\0' && (isalnum(lexer->current_char) || lexer->current_char == '_'))
+    const char *start = lexer->cursor;
+    while (!at_end(lexer) && (isalnum((unsigned char)*lexer->cursor) || *lexer->cursor == '_'))
     {
-        if (i >= 255)
-        {
-            fprintf(stderr, "Identifier too long at line %d\n", line);
-            exit(1);
-        }
-        buffer[i++] = lexer->current_char;
-        advance(lexer);
+        lexer->cursor++;
     }
 
-    buffer[i] = '\0';
-
-    // Check for keywords
-    if (strcmp(buffer, "route") == 0)
-    {
-        return token_create(TOKEN_ROUTE, buffer, line, column);
-    }
-    else if (strcmp(buffer, "response") == 0)
-    {
-        return token_create(TOKEN_RESPONSE, buffer, line, column);
-    }
-    else if (strcmp(buffer, "html") == 0)
+    size_t len = lexer->cursor - start;
+    TokenType type = TOKEN_IDENTIFIER;
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
     {
-        return token_create(TOKEN_HTML, buffer, line, column);
-    }
-    else if (strcmp(buffer, "if") == 0)
-    {
-        return token_create(TOKEN_IF, buffer, line, column);
-    }
-    else if (strcmp(buffer, "else") == 0)
-    {
-        return token_create(TOKEN_ELSE, buffer, line, column);
-    }
-    else if (strcmp(buffer, "while") == 0)
-    {
-        return token_create(TOKEN_WHILE, buffer, line, column);
-    }
-    else if (strcmp(buffer, "for") == 0)
-    {
-        return token_create(TOKEN_FOR, buffer, line, column);
-    }
-    else if (strcmp(buffer, "function") == 0)
-    {
-        return token_create(TOKEN_FUNCTION, buffer, line, column);
-    }
-    else if (strcmp(buffer, "return") == 0)
-    {
-        return token_create(TOKEN_RETURN, buffer, line, column);
+        if (keywords[i].len == len && memcmp(keywords[i].word, start, len) == 0)
+        {
+            type = keywords[i].type;
+            break;
+        }
     }
-
-    return token_create(TOKEN_IDENTIFIER, buffer, line, column);
+    token_init(lexer, token, type, start, len, lexer->line, (int)(start - lexer->line_start));
 }
 
 // Initialize lexer
 Lexer *lexer_init(const char *source)
+{
+    return lexer_init_len(source, strlen(source));
+}
+
+Lexer *lexer_init_len(const char *source, size_t length)
 {
     Lexer *lexer = (Lexer *)malloc(sizeof(Lexer));
     lexer->source = source;
-    lexer->position = 0;
+    lexer->end = source + length;
+    lexer->cursor = source;
+    lexer->line_start = source;
     lexer->line = 1;
-    lexer->column = 0;
-    lexer->current_char = source[0];
+    lexer->text = NULL;
+    lexer->diagnostics = NULL;
     return lexer;
 }
 
@@ -195,132 +179,181 @@ void lexer_free(Lexer *lexer)
     free(lexer);
 }
 
-// Get next token
-Token *lexer_next_token(Lexer *lexer)
+static TokenType two_char_type(char current, char next)
+{
+    if (current == '=' && next == '=')
+        return TOKEN_EQ;
+    if (current == '!' && next == '=')
+        return TOKEN_NEQ;
+    if (current == '<' && next == '=')
+        return TOKEN_LTE;
+    if (current == '>' && next == '=')
+        return TOKEN_GTE;
+    if (current == '&' && next == '&')
+        return TOKEN_AND;
+    if (current == '|' && next == '|')
+        return TOKEN_OR;
+    return TOKEN_UNKNOWN;
+}
+
+static TokenType one_char_type(char current)
+{
+    switch (current)
+    {
+    case '{':
+        return TOKEN_LBRACE;
+    case '}':
+        return TOKEN_RBRACE;
+    case '(':
+        return TOKEN_LPAREN;
+    case ')':
+        return TOKEN_RPAREN;
+    case '=':
+        return TOKEN_EQUALS;
+    case '+':
+        return TOKEN_PLUS;
+    case '-':
+        return TOKEN_MINUS;
+    case '*':
+        return TOKEN_STAR;
+    case '/':
+        return TOKEN_SLASH;
+    case '.':
+        return TOKEN_DOT;
+    case ',':
+        return TOKEN_COMMA;
+    case ':':
+        return TOKEN_COLON;
+    case ';':
+        return TOKEN_SEMICOLON;
+    case '<':
+        return TOKEN_LT;
+    case '>':
+        return TOKEN_GT;
+    default:
+        return TOKEN_UNKNOWN;
+    }
+}
+
+// Scan the next token into *token
+static void scan_token(Lexer *lexer, Token *token)
 {
-    while (lexer->current_char != '\0')
+    while (!at_end(lexer))
     {
+        char current = *lexer->cursor;
+
         // Skip whitespace
-        if (isspace(lexer->current_char))
+        if (isspace((unsigned char)current))
         {
             skip_whitespace(lexer);
             continue;
         }
 
         // Skip comments
-        if (lexer->current_char == '/' && lexer->position + 1 < strlen(lexer->source) && lexer->source[lexer->position + 1] == '/')
+        if (current == '/' && peek(lexer, 1) == '/')
         {
             skip_comment(lexer);
             continue;
         }
 
-        int line = lexer->line;
-        int column = lexer->column;
-
         // String literals
-        if (lexer->current_char == '"')
+        if (current == '"')
         {
-            return read_string(lexer);
+            read_string(lexer, token);
+            return;
         }
 
         // Numbers
-        if (isdigit(lexer->current_char))
+        if (isdigit((unsigned char)current))
         {
-            return read_number(lexer);
+            read_number(lexer, token);
+            return;
         }
 
         // Identifiers and keywords
-        if (isalpha(lexer->current_char) || lexer->current_char == '_')
+        if (isalpha((unsigned char)current) || current == '_')
         {
-            return read_identifier(lexer);
+            read_identifier(lexer, token);
+            return;
         }
 
-        // Single character tokens
-        char current = lexer->current_char;
-        advance(lexer);
+        const char *start = lexer->cursor;
+        int line = lexer->line;
+        int col = column(lexer);
 
         // Check for two-character operators
-        if (current == '=' && lexer->current_char == '=')
-        {
-            advance(lexer);
-            return token_create(TOKEN_EQ, "==", line, column);
-        }
-        if (current == '!' && lexer->current_char == '=')
-        {
-            advance(lexer);
-            return token_create(TOKEN_NEQ, "!=", line, column);
-        }
-        if (current == '<' && lexer->current_char == '=')
-        {
-            advance(lexer);
-            return token_create(TOKEN_LTE, "<=", line, column);
-        }
-        if (current == '>' && lexer->current_char == '=')
-        {
-            advance(lexer);
-            return token_create(TOKEN_GTE, ">=", line, column);
-        }
-        if (current == '&' && lexer->current_char == '&')
-        {
-            advance(lexer);
-            return token_create(TOKEN_AND, "&&", line, column);
-        }
-        if (current == '|' && lexer->current_char == '|')
+        TokenType type = two_char_type(current, peek(lexer, 1));
+        if (type != TOKEN_UNKNOWN)
         {
-            advance(lexer);
-            return token_create(TOKEN_OR, "||", line, column);
+            lexer->cursor += 2;
+            token_init(lexer, token, type, start, 2, line, col);
+            return;
         }
 
-        switch (current)
+        // Single character tokens
+        lexer->cursor++;
+        type = one_char_type(current);
+        if (type == TOKEN_UNKNOWN)
         {
-        case '{':
-            return token_create(TOKEN_LBRACE, "{", line, column);
-        case '}':
-            return token_create(TOKEN_RBRACE, "}", line, column);
-        case '(':
-            return token_create(TOKEN_LPAREN, "(", line, column);
-        case ')':
-            return token_create(TOKEN_RPAREN, ")", line, column);
-        case '=':
-            return token_create(TOKEN_EQUALS, "=", line, column);
-        case '+':
-            return token_create(TOKEN_PLUS, "+", line, column);
-        case '-':
-            return token_create(TOKEN_MINUS, "-", line, column);
-        case '*':
-            return token_create(TOKEN_STAR, "*", line, column);
-        case '/':
-            return token_create(TOKEN_SLASH, "/", line, column);
-        case '.':
-            return token_create(TOKEN_DOT, ".", line, column);
-        case ',':
-            return token_create(TOKEN_COMMA, ",", line, column);
-        case ':':
-            return token_create(TOKEN_COLON, ":", line, column);
-        case ';':
-            return token_create(TOKEN_SEMICOLON, ";", line, column);
-        case '<':
-            return token_create(TOKEN_LT, "<", line, column);
-        case '>':
-            return token_create(TOKEN_GT, ">", line, column);
-        default:
-            fprintf(stderr, "Unknown character '%c' at line %d, column %d\n",
-                    current, line, column);
-            return token_create(TOKEN_UNKNOWN, NULL, line, column);
+            if ((unsigned char)current >= 0x80)
+            {
+                // One error for a whole UTF-8 character, not one per byte
+                while (!at_end(lexer) && ((unsigned char)*lexer->cursor & 0xC0) == 0x80)
+                    lexer->cursor++;
+                lexer_error(lexer, line, col, "Unexpected non-ASCII character");
+            }
+            else if (isprint((unsigned char)current))
+            {
+                lexer_error(lexer, line, col, "Unknown character '%c'", current);
+            }
+            else
+            {
+                lexer_error(lexer, line, col, "Unexpected control character 0x%02x", current);
+            }
+            token_init(lexer, token, TOKEN_UNKNOWN, NULL, 0, line, col);
+            return;
         }
+        token_init(lexer, token, type, start, 1, line, col);
+        return;
     }
 
-    return token_create(TOKEN_EOF, NULL, lexer->line, lexer->column);
+    token_init(lexer, token, TOKEN_EOF, NULL, 0, lexer->line, column(lexer));
 }
 
-// Free token
-void token_free(Token *token)
+// Tokenize the rest of the source into list, ending with the EOF token.
+// The token array is sized from the source length up front (tokens average
+// well over four bytes of source), so it rarely grows. Token text never
+// moves once written: each value is a slice of the source plus a NUL, so
+// twice the source length always holds them all.
+void lexer_tokenize(Lexer *lexer, TokenList *list)
 {
-    if (token->value)
+    size_t remaining = lexer->end - lexer->cursor;
+    int capacity = (int)(remaining / 4) + 16;
+    list->tokens = (Token *)malloc(sizeof(Token) * capacity);
+    list->text = (char *)malloc(remaining * 2 + 1);
+    list->count = 0;
+    lexer->text = list->text;
+
+    do
     {
-        free(token->value);
-    }
-    free(token);
+        if (list->count == capacity)
+        {
+            capacity *= 2;
+            list->tokens = (Token *)realloc(list->tokens, sizeof(Token) * capacity);
+        }
+        scan_token(lexer, &list->tokens[list->count++]);
+    } while (list->tokens[list->count - 1].type != TOKEN_EOF);
+
+    lexer->text = NULL;
+}
+
+void token_list_free(TokenList *list)
+{
+    free(list->tokens);
+    free(list->text);
+    list->tokens = NULL;
+    list->text = NULL;
+    list->count = 0;
 }
 
 // Convert token type to string
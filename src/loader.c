@@ -0,0 +1,91 @@
+#include "loader.h"
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The lexer is bounded by length and everything the AST keeps is copied
+// into its arena, so the mapping is only needed while parsing. NULL, with
+// the syntax errors on stderr, if the source doesn't parse.
+static ASTNode *parse_source(const char *path, const char *source, size_t length)
+{
+    Lexer *lexer = lexer_init_len(source, length);
+    Parser *parser = parser_init(lexer);
+    ASTNode *ast = parser_parse(parser);
+    diagnostics_print(&parser->diagnostics, path, stderr);
+    parser_free(parser);
+    lexer_free(lexer);
+
+    if (ast)
+    {
+        optimize_program(ast);
+        resolve_program(ast);
+    }
+    return ast;
+}
+
+int program_load(const char *path, LoadedProgram *program)
+{
+    program->ast = NULL;
+    program->image = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // An empty file is an empty program; mmap refuses zero lengths
+    size_t size = (size_t)st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        program->ast = parse_source(path, "", 0);
+        return 0;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Images are recognised by their magic, whatever the file is called,
+    // and served from this same mapping, so a file replaced meanwhile can't
+    // be mistaken for the one checked
+    if (size >= sizeof(IMAGE_MAGIC) && memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0)
+    {
+        program->image = image_open_mapping(path, data, size);
+        return program->image ? 0 : -1;
+    }
+
+    program->ast = parse_source(path, (const char *)data, size);
+    munmap(data, size);
+    return program->ast ? 0 : -1;
+}
+
+void program_unload(LoadedProgram *program)
+{
+    ast_free(program->ast);
+    image_close(program->image);
+    program->ast = NULL;
+    program->image = NULL;
+}
@@ -1,10 +1,88 @@
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
+#include "optimizer.h"
+#include "resolver.h"
 #include "interpreter.h"
+#include "bytecode.h"
+#include "router.h"
+#include "image.h"
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main()
+// webbubble compile app.bub [-o app.bubc]: build a program image for
+// webbubble-server. The output defaults to the input with a .bubc extension.
+static int compile_command(int argc, char *argv[])
 {
+    const char *input = NULL;
+    const char *output = NULL;
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+            input = argv[i];
+    }
+    if (!input)
+    {
+        fprintf(stderr, "Usage: webbubble compile app.bub [-o app.bubc]\n");
+        return 1;
+    }
+
+    char *default_output = NULL;
+    if (!output)
+    {
+        size_t len = strlen(input);
+        if (len > 4 && strcmp(input + len - 4, ".bub") == 0)
+            len -= 4;
+        default_output = (char *)malloc(len + 6);
+        memcpy(default_output, input, len);
+        strcpy(default_output + len, ".bubc");
+        output = default_output;
+    }
+
+    LoadedProgram program;
+    if (program_load(input, &program) < 0)
+    {
+        free(default_output);
+        return 1;
+    }
+    if (!program.ast)
+    {
+        fprintf(stderr, "%s is already compiled\n", input);
+        program_unload(&program);
+        free(default_output);
+        return 1;
+    }
+
+    int status = 1;
+    BytecodeProgram *bytecode = bytecode_compile(program.ast);
+    Router *router = router_compile(program.ast);
+    if (!bytecode)
+        fprintf(stderr, "%s: program is too large to compile to bytecode\n", input);
+    else if (image_write(output, bytecode, router) == 0)
+    {
+        printf("Compiled %u routes and %u functions into %s\n", bytecode->route_count,
+               bytecode->function_count, output);
+        status = 0;
+    }
+
+    router_free(router);
+    bytecode_free(bytecode);
+    program_unload(&program);
+    free(default_output);
+    return status;
+}
+
+// Usage: webbubble                                run the built-in example
+//        webbubble compile app.bub [-o app.bubc]  precompile a program
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "compile") == 0)
+        return compile_command(argc - 2, argv + 2);
+
     // Example web language code
     const char *source =
         "// Simple web language example\n"
@@ -37,6 +115,15 @@ int main()
     // Parse the program
     printf("\n=== Parsing ===\n");
     ASTNode *ast = parser_parse(parser);
+    if (!ast)
+    {
+        diagnostics_print(&parser->diagnostics, "example", stderr);
+        parser_free(parser);
+        lexer_free(lexer);
+        return 1;
+    }
+    optimize_program(ast);
+    resolve_program(ast);
     printf("Parse successful!\n");
 
     // Print the AST
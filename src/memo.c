@@ -0,0 +1,280 @@
+#include "memo.h"
+#include <stdlib.h>
+#include <string.h>
+
+// One cached call. The key bytes and a string result are stored right
+// after the struct, in the same allocation.
+struct MemoEntry {
+    MemoEntry *hash_next;
+    MemoEntry *newer;
+    MemoEntry *older;
+    uint64_t hash;
+    size_t key_len;
+    Value result;          // A string result points past the key
+    unsigned char data[];
+};
+
+// ===== KEYS =====
+
+// Key layout: function index, then per argument a type byte followed by
+// the number's bits, the bool, or the string and its NUL
+static size_t encoded_size(const Value *value)
+{
+    switch (value->type)
+    {
+    case VAL_NUMBER:
+        return 1 + sizeof(double);
+    case VAL_BOOL:
+        return 2;
+    case VAL_STRING:
+        return 1 + strlen(value->data.string) + 1;
+    default:
+        return 1;
+    }
+}
+
+static uint64_t hash_bytes(const unsigned char *bytes, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    // Keys differ mostly in their last bytes, which FNV leaves in the low
+    // bits; mix them up into the top bits that pick the shard
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+MemoKey *memo_key_create(Arena *arena, uint32_t function, const Value *args, int count)
+{
+    size_t len = sizeof(uint32_t);
+    for (int i = 0; i < count; i++)
+    {
+        len += encoded_size(&args[i]);
+    }
+
+    MemoKey *key = (MemoKey *)arena_alloc(arena, sizeof(MemoKey));
+    unsigned char *p = (unsigned char *)arena_alloc(arena, len);
+    key->bytes = p;
+    key->len = len;
+
+    memcpy(p, &function, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    for (int i = 0; i < count; i++)
+    {
+        const Value *arg = &args[i];
+        *p++ = (unsigned char)arg->type;
+        switch (arg->type)
+        {
+        case VAL_NUMBER:
+            memcpy(p, &arg->data.number, sizeof(double));
+            p += sizeof(double);
+            break;
+        case VAL_BOOL:
+            *p++ = (unsigned char)(arg->data.boolean != 0);
+            break;
+        case VAL_STRING:
+        {
+            size_t n = strlen(arg->data.string) + 1;
+            memcpy(p, arg->data.string, n);
+            p += n;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    key->hash = hash_bytes(key->bytes, key->len);
+    return key;
+}
+
+// ===== CACHE =====
+
+static MemoShard *shard_for(MemoCache *cache, uint64_t hash)
+{
+    // Top bits pick the shard, low bits the bucket within it
+    return &cache->shards[hash >> 60 & (MEMO_SHARDS - 1)];
+}
+
+MemoCache *memo_cache_create(size_t capacity)
+{
+    MemoCache *cache = (MemoCache *)calloc(1, sizeof(MemoCache));
+    size_t per_shard = (capacity + MEMO_SHARDS - 1) / MEMO_SHARDS;
+    if (per_shard == 0)
+        per_shard = 1;
+
+    size_t bucket_count = 1;
+    while (bucket_count < per_shard)
+        bucket_count <<= 1;
+
+    for (int i = 0; i < MEMO_SHARDS; i++)
+    {
+        MemoShard *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->buckets = (MemoEntry **)calloc(bucket_count, sizeof(MemoEntry *));
+        shard->bucket_mask = bucket_count - 1;
+        shard->capacity = per_shard;
+    }
+    return cache;
+}
+
+void memo_cache_free(MemoCache *cache)
+{
+    if (!cache)
+        return;
+    for (int i = 0; i < MEMO_SHARDS; i++)
+    {
+        MemoShard *shard = &cache->shards[i];
+        MemoEntry *entry = shard->newest;
+        while (entry)
+        {
+            MemoEntry *older = entry->older;
+            free(entry);
+            entry = older;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+static MemoEntry *shard_find(MemoShard *shard, const MemoKey *key)
+{
+    MemoEntry *entry = shard->buckets[key->hash & shard->bucket_mask];
+    while (entry)
+    {
+        if (entry->hash == key->hash && entry->key_len == key->len &&
+            memcmp(entry->data, key->bytes, key->len) == 0)
+            return entry;
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+static void lru_unlink(MemoShard *shard, MemoEntry *entry)
+{
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+}
+
+static void lru_push(MemoShard *shard, MemoEntry *entry)
+{
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest)
+        shard->newest->newer = entry;
+    else
+        shard->oldest = entry;
+    shard->newest = entry;
+}
+
+static void shard_evict(MemoShard *shard)
+{
+    MemoEntry *victim = shard->oldest;
+    lru_unlink(shard, victim);
+
+    MemoEntry **link = &shard->buckets[victim->hash & shard->bucket_mask];
+    while (*link != victim)
+        link = &(*link)->hash_next;
+    *link = victim->hash_next;
+
+    free(victim);
+    shard->count--;
+    shard->evictions++;
+}
+
+int memo_cache_lookup(MemoCache *cache, const MemoKey *key, Arena *arena, Value *result)
+{
+    MemoShard *shard = shard_for(cache, key->hash);
+    pthread_mutex_lock(&shard->lock);
+
+    MemoEntry *entry = shard_find(shard, key);
+    if (!entry)
+    {
+        shard->misses++;
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    shard->hits++;
+    if (shard->newest != entry)
+    {
+        lru_unlink(shard, entry);
+        lru_push(shard, entry);
+    }
+
+    // Copy out while locked: another worker may evict the entry
+    *result = entry->result;
+    if (result->type == VAL_STRING)
+        *result = value_create_arena_string(arena, entry->result.data.string,
+                                            strlen(entry->result.data.string));
+
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+void memo_cache_store(MemoCache *cache, const MemoKey *key, const Value *result)
+{
+    size_t string_len = result->type == VAL_STRING ? strlen(result->data.string) + 1 : 0;
+    MemoEntry *entry = (MemoEntry *)malloc(sizeof(MemoEntry) + key->len + string_len);
+    entry->hash = key->hash;
+    entry->key_len = key->len;
+    memcpy(entry->data, key->bytes, key->len);
+    entry->result = *result;
+    if (string_len)
+    {
+        char *copy = (char *)entry->data + key->len;
+        memcpy(copy, result->data.string, string_len);
+        entry->result = value_borrow_string(copy);
+    }
+
+    MemoShard *shard = shard_for(cache, key->hash);
+    pthread_mutex_lock(&shard->lock);
+
+    // Another worker may have computed the same call meanwhile
+    if (shard_find(shard, key))
+    {
+        pthread_mutex_unlock(&shard->lock);
+        free(entry);
+        return;
+    }
+
+    if (shard->count == shard->capacity)
+        shard_evict(shard);
+
+    MemoEntry **bucket = &shard->buckets[key->hash & shard->bucket_mask];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    lru_push(shard, entry);
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void memo_cache_stats(MemoCache *cache, MemoStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < MEMO_SHARDS; i++)
+    {
+        MemoShard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->count;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,456 @@
+#include "optimizer.h"
+#include "interpreter.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Per-route facts about one variable name
+typedef struct {
+    const char *name;
+    int assignments;     // Anywhere in the route, nested or not
+    int reads;
+    ASTNode *constant;   // Literal it holds from here on, or NULL
+} Binding;
+
+typedef struct {
+    Binding *bindings;
+    int count;
+    int capacity;
+    Arena scratch;       // Values computed for the current route
+    ASTArena *ast;       // New literals and statement lists go here
+    ASTNode **stack;     // Statements of the blocks being rebuilt
+    int stack_count;
+    int stack_capacity;
+} Optimizer;
+
+// Names are interned, so they compare by pointer
+static Binding *find_binding(Optimizer *opt, const char *name)
+{
+    for (int i = 0; i < opt->count; i++)
+    {
+        if (opt->bindings[i].name == name)
+            return &opt->bindings[i];
+    }
+    return NULL;
+}
+
+static Binding *get_binding(Optimizer *opt, const char *name)
+{
+    Binding *binding = find_binding(opt, name);
+    if (binding)
+        return binding;
+
+    if (opt->count == opt->capacity)
+    {
+        opt->capacity = opt->capacity ? opt->capacity * 2 : 16;
+        opt->bindings = (Binding *)realloc(opt->bindings, sizeof(Binding) * opt->capacity);
+    }
+    binding = &opt->bindings[opt->count++];
+    binding->name = name;
+    binding->assignments = 0;
+    binding->reads = 0;
+    binding->constant = NULL;
+    return binding;
+}
+
+static void count_assignments(Optimizer *opt, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case AST_ASSIGNMENT:
+        get_binding(opt, node->data.assignment.name)->assignments++;
+        break;
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            count_assignments(opt, node->data.block.statements[i]);
+        }
+        break;
+    case AST_IF:
+        count_assignments(opt, node->data.if_stmt.then_branch);
+        count_assignments(opt, node->data.if_stmt.else_branch);
+        break;
+    case AST_WHILE:
+        count_assignments(opt, node->data.while_stmt.body);
+        break;
+    default:
+        break;
+    }
+}
+
+static void count_reads(Optimizer *opt, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case AST_IDENTIFIER:
+        get_binding(opt, node->data.identifier.name)->reads++;
+        break;
+    case AST_ASSIGNMENT:
+        count_reads(opt, node->data.assignment.value);
+        break;
+    case AST_RESPONSE:
+        count_reads(opt, node->data.response.value);
+        break;
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            count_reads(opt, node->data.block.statements[i]);
+        }
+        break;
+    case AST_BINARY_OP:
+        count_reads(opt, node->data.binary_op.left);
+        count_reads(opt, node->data.binary_op.right);
+        break;
+    case AST_IF:
+        count_reads(opt, node->data.if_stmt.condition);
+        count_reads(opt, node->data.if_stmt.then_branch);
+        count_reads(opt, node->data.if_stmt.else_branch);
+        break;
+    case AST_WHILE:
+        count_reads(opt, node->data.while_stmt.condition);
+        count_reads(opt, node->data.while_stmt.body);
+        break;
+    case AST_RETURN:
+        count_reads(opt, node->data.return_stmt.value);
+        break;
+    case AST_FUNCTION_CALL:
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            count_reads(opt, node->data.function_call.args[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// ===== CONSTANTS =====
+
+static int is_literal(ASTNode *node)
+{
+    return node && (node->type == AST_STRING || node->type == AST_NUMBER);
+}
+
+// Evaluate node if it only involves literals, with the interpreter's own
+// operator semantics. Division by zero is left for runtime to report.
+static int constant_value(Optimizer *opt, ASTNode *node, Value *out)
+{
+    switch (node->type)
+    {
+    case AST_STRING:
+        *out = value_borrow_string(node->data.string.value);
+        return 1;
+    case AST_NUMBER:
+        *out = value_create_number(node->data.number.value);
+        return 1;
+    case AST_BINARY_OP:
+    {
+        Value left, right;
+        if (!constant_value(opt, node->data.binary_op.left, &left) ||
+            !constant_value(opt, node->data.binary_op.right, &right))
+            return 0;
+        if (node->data.binary_op.op == BINOP_DIV &&
+            !(right.type == VAL_NUMBER && right.data.number != 0))
+            return 0;
+        *out = value_binary_op(&opt->scratch, node->data.binary_op.op, &left, &right);
+        return out->type != VAL_NULL;
+    }
+    default:
+        return 0;
+    }
+}
+
+// Turn node into a literal holding value (numbers and strings only). What
+// the node pointed to before stays in the arena, unreachable.
+static int make_literal(Optimizer *opt, ASTNode *node, Value *value)
+{
+    if (value->type == VAL_NUMBER)
+    {
+        node->type = AST_NUMBER;
+        node->data.number.value = value->data.number;
+        return 1;
+    }
+    if (value->type == VAL_STRING)
+    {
+        node->type = AST_STRING;
+        node->data.string.value = intern_cstr(&opt->ast->strings, value->data.string);
+        return 1;
+    }
+    return 0;
+}
+
+// ===== FOLDING =====
+
+static void fold_expression(Optimizer *opt, ASTNode *node)
+{
+    switch (node->type)
+    {
+    case AST_IDENTIFIER:
+    {
+        Binding *binding = find_binding(opt, node->data.identifier.name);
+        if (binding && binding->constant)
+        {
+            Value value;
+            constant_value(opt, binding->constant, &value);
+            make_literal(opt, node, &value);
+        }
+        break;
+    }
+
+    case AST_FUNCTION_CALL:
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            fold_expression(opt, node->data.function_call.args[i]);
+        }
+        break;
+
+    case AST_BINARY_OP:
+    {
+        fold_expression(opt, node->data.binary_op.left);
+        fold_expression(opt, node->data.binary_op.right);
+        Value value;
+        if (constant_value(opt, node, &value))
+            make_literal(opt, node, &value); // Booleans stay as expressions
+        break;
+    }
+
+    case AST_BLOCK:
+    {
+        // HTML block: only its identifiers are output, concatenated
+        Value text = value_borrow_string("");
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *stmt = node->data.block.statements[i];
+            if (stmt->type != AST_IDENTIFIER)
+                continue;
+            // Literal statements are ignored at runtime, so leave the
+            // identifiers alone unless the whole block folds
+            Binding *binding = find_binding(opt, stmt->data.identifier.name);
+            Value part;
+            if (!binding || !binding->constant ||
+                !constant_value(opt, binding->constant, &part))
+                return;
+            text = value_concat(&opt->scratch, &text, &part);
+        }
+        make_literal(opt, node, &text);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+static void fold_block(Optimizer *opt, ASTNode *block, int top_level);
+
+// Fold one statement. Returns the node that should stand in its place,
+// which is NULL when the statement can be dropped.
+static ASTNode *fold_statement(Optimizer *opt, ASTNode *node, int top_level)
+{
+    switch (node->type)
+    {
+    case AST_ASSIGNMENT:
+    {
+        fold_expression(opt, node->data.assignment.value);
+        Binding *binding = find_binding(opt, node->data.assignment.name);
+        // Only a top-level single assignment holds for every later read
+        if (top_level && binding->assignments == 1 && is_literal(node->data.assignment.value))
+            binding->constant = node->data.assignment.value;
+        return node;
+    }
+
+    case AST_RESPONSE:
+        fold_expression(opt, node->data.response.value);
+        return node;
+
+    case AST_RETURN:
+        if (node->data.return_stmt.value)
+            fold_expression(opt, node->data.return_stmt.value);
+        return node;
+
+    case AST_FUNCTION_CALL:
+        fold_expression(opt, node);
+        return node;
+
+    case AST_BLOCK:
+        fold_block(opt, node, 0);
+        return node;
+
+    case AST_IF:
+    {
+        fold_expression(opt, node->data.if_stmt.condition);
+        Value condition;
+        if (!constant_value(opt, node->data.if_stmt.condition, &condition))
+        {
+            fold_block(opt, node->data.if_stmt.then_branch, 0);
+            if (node->data.if_stmt.else_branch)
+                node->data.if_stmt.else_branch =
+                    fold_statement(opt, node->data.if_stmt.else_branch, 0);
+            return node;
+        }
+
+        ASTNode *taken = value_truthy(&condition) ? node->data.if_stmt.then_branch
+                                                  : node->data.if_stmt.else_branch;
+        return taken ? fold_statement(opt, taken, 0) : NULL;
+    }
+
+    case AST_WHILE:
+    {
+        fold_expression(opt, node->data.while_stmt.condition);
+        Value condition;
+        if (constant_value(opt, node->data.while_stmt.condition, &condition) &&
+            !value_truthy(&condition))
+            return NULL;
+        fold_block(opt, node->data.while_stmt.body, 0);
+        return node;
+    }
+
+    default:
+        return node;
+    }
+}
+
+static void push_statement(Optimizer *opt, ASTNode *stmt)
+{
+    if (opt->stack_count == opt->stack_capacity)
+    {
+        opt->stack_capacity = opt->stack_capacity ? opt->stack_capacity * 2 : 64;
+        opt->stack = (ASTNode **)realloc(opt->stack, sizeof(ASTNode *) * opt->stack_capacity);
+    }
+    opt->stack[opt->stack_count++] = stmt;
+}
+
+// The folded statements collect on the stack above those of any enclosing
+// block, and replace the block's list only if something changed
+static void fold_block(Optimizer *opt, ASTNode *block, int top_level)
+{
+    int mark = opt->stack_count;
+    int changed = 0;
+    for (int i = 0; i < block->data.block.statement_count; i++)
+    {
+        ASTNode *original = block->data.block.statements[i];
+        ASTNode *stmt = fold_statement(opt, original, top_level);
+        changed |= stmt != original;
+        if (!stmt)
+            continue;
+        if (stmt->type != AST_BLOCK)
+        {
+            push_statement(opt, stmt);
+            continue;
+        }
+
+        // The branch an if was replaced by; blocks have no scope of their own
+        changed = 1;
+        for (int j = 0; j < stmt->data.block.statement_count; j++)
+        {
+            push_statement(opt, stmt->data.block.statements[j]);
+        }
+    }
+    if (changed)
+        ast_block_set_statements(opt->ast, block, opt->stack + mark, opt->stack_count - mark);
+    opt->stack_count = mark;
+}
+
+// ===== DEAD STORES =====
+
+static int is_pure(ASTNode *node)
+{
+    switch (node->type)
+    {
+    case AST_STRING:
+    case AST_NUMBER:
+    case AST_IDENTIFIER:
+        return 1;
+    case AST_BINARY_OP:
+        return is_pure(node->data.binary_op.left) && is_pure(node->data.binary_op.right);
+    default:
+        return 0;
+    }
+}
+
+// Drop assignments nobody reads. Returns how many were removed.
+static int remove_dead_stores(Optimizer *opt, ASTNode *block)
+{
+    int removed = 0;
+    int kept = 0;
+    for (int i = 0; i < block->data.block.statement_count; i++)
+    {
+        ASTNode *stmt = block->data.block.statements[i];
+        if (stmt->type == AST_ASSIGNMENT && is_pure(stmt->data.assignment.value) &&
+            find_binding(opt, stmt->data.assignment.name)->reads == 0)
+        {
+            removed++;
+            continue;
+        }
+        if (stmt->type == AST_BLOCK)
+            removed += remove_dead_stores(opt, stmt);
+        else if (stmt->type == AST_IF)
+        {
+            removed += remove_dead_stores(opt, stmt->data.if_stmt.then_branch);
+            if (stmt->data.if_stmt.else_branch && stmt->data.if_stmt.else_branch->type == AST_BLOCK)
+                removed += remove_dead_stores(opt, stmt->data.if_stmt.else_branch);
+        }
+        else if (stmt->type == AST_WHILE)
+            removed += remove_dead_stores(opt, stmt->data.while_stmt.body);
+        block->data.block.statements[kept++] = stmt;
+    }
+    block->data.block.statement_count = kept;
+    return removed;
+}
+
+// ===== ROUTES =====
+
+static int body_is_constant(ASTNode *body)
+{
+    for (int i = 0; i < body->data.block.statement_count; i++)
+    {
+        ASTNode *stmt = body->data.block.statements[i];
+        if (stmt->type != AST_RESPONSE || !is_literal(stmt->data.response.value))
+            return 0;
+    }
+    return 1;
+}
+
+static void optimize_route(Optimizer *opt, ASTNode *route)
+{
+    ASTNode *body = route->data.route.body;
+
+    opt->count = 0;
+    count_assignments(opt, body);
+    fold_block(opt, body, 1);
+
+    // Each removal can leave more variables unread
+    do
+    {
+        for (int i = 0; i < opt->count; i++)
+        {
+            opt->bindings[i].reads = 0;
+        }
+        count_reads(opt, body);
+    } while (remove_dead_stores(opt, body) > 0);
+
+    route->data.route.is_constant = body_is_constant(body);
+}
+
+void optimize_program(ASTNode *program)
+{
+    Optimizer opt;
+    memset(&opt, 0, sizeof(opt));
+    arena_init(&opt.scratch, 0);
+    opt.ast = program->data.program.arena;
+
+    for (int i = 0; i < program->data.program.route_count; i++)
+    {
+        optimize_route(&opt, program->data.program.routes[i]);
+        arena_reset(&opt.scratch);
+    }
+
+    arena_free(&opt.scratch);
+    free(opt.bindings);
+    free(opt.stack);
+}
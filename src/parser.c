@@ -1,35 +1,23 @@
 #include "parser.h"
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-// Helper: Peek at next token without consuming it
-static Token *peek_next(Parser *parser)
+// Helper: Look offset tokens past the current one; EOF once past the end
+static Token *peek(Parser *parser, int offset)
 {
-    int saved_pos = parser->lexer->position;
-    int saved_line = parser->lexer->line;
-    int saved_column = parser->lexer->column;
-    char saved_char = parser->lexer->current_char;
-
-    Token *next = lexer_next_token(parser->lexer);
-
-    // Restore lexer state
-    parser->lexer->position = saved_pos;
-    parser->lexer->line = saved_line;
-    parser->lexer->column = saved_column;
-    parser->lexer->current_char = saved_char;
-
-    return next;
+    int index = parser->position + offset;
+    if (index >= parser->tokens.count)
+        index = parser->tokens.count - 1;
+    return &parser->tokens.tokens[index];
 }
 
-// Helper: Advance to next token
+// Helper: Advance to next token, staying on EOF
 static void advance(Parser *parser)
 {
-    if (parser->current_token)
-    {
-        token_free(parser->current_token);
-    }
-    parser->current_token = lexer_next_token(parser->lexer);
+    if (parser->current_token->type != TOKEN_EOF)
+        parser->current_token = &parser->tokens.tokens[++parser->position];
 }
 
 // Helper: Check if current token matches expected type
@@ -38,32 +26,134 @@ static int check(Parser *parser, TokenType type)
     return parser->current_token->type == type;
 }
 
+// Helper: Record a syntax error at the current token and skip to EOF, where
+// every loop below ends, so the parse unwinds without going further. Only
+// the first error is kept, and none for an unknown token: the lexer has
+// already reported it.
+static void parse_error(Parser *parser, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void parse_error(Parser *parser, const char *format, ...)
+{
+    Token *token = parser->current_token;
+    if (!parser->failed && token->type != TOKEN_UNKNOWN)
+    {
+        char message[DIAGNOSTIC_MESSAGE_SIZE];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        diagnostics_add(&parser->diagnostics, token->line, token->column + 1, "%s", message);
+    }
+    parser->failed = 1;
+    parser->position = parser->tokens.count - 1;
+    parser->current_token = &parser->tokens.tokens[parser->position];
+}
+
+// Helper: Stands in for a node that failed to parse; the program is
+// discarded anyway
+static ASTNode *error_node(Parser *parser)
+{
+    return ast_create_number(parser->ast, 0);
+}
+
 // Helper: Consume token if it matches, otherwise error
 static void expect(Parser *parser, TokenType type, const char *message)
 {
     if (!check(parser, type))
     {
-        fprintf(stderr, "Parse error at line %d: %s\n",
-                parser->current_token->line, message);
-        fprintf(stderr, "Expected %s, got %s\n",
-                token_type_to_string(type),
-                token_type_to_string(parser->current_token->type));
-        exit(1);
+        parse_error(parser, "%s, got %s", message,
+                    token_type_to_string(parser->current_token->type));
+        return;
     }
     advance(parser);
 }
 
+// Helper: Go one level deeper before recursing, or record an error and
+// return 0 past PARSER_MAX_DEPTH. Each successful call is paired with
+// parser->depth-- on the way out.
+static int enter(Parser *parser)
+{
+    if (parser->depth >= PARSER_MAX_DEPTH)
+    {
+        parse_error(parser, "Nesting too deep (more than %d levels)", PARSER_MAX_DEPTH);
+        return 0;
+    }
+    parser->depth++;
+    return 1;
+}
+
+// Helper: Record the height of the expression just built. Operator chains
+// are parsed in a loop rather than by recursion but still nest in the tree,
+// so their height is limited here.
+static void set_height(Parser *parser, int height)
+{
+    if (height > PARSER_MAX_DEPTH)
+        parse_error(parser, "Nesting too deep (more than %d levels)", PARSER_MAX_DEPTH);
+    parser->height = height;
+}
+
+// Helper: Build left op right, where left is left_height tall and right is
+// the expression just parsed
+static ASTNode *binary_node(Parser *parser, BinaryOperator op, ASTNode *left, int left_height,
+                            ASTNode *right)
+{
+    int tallest = left_height > parser->height ? left_height : parser->height;
+    set_height(parser, tallest + 1);
+    return ast_create_binary_op(parser->ast, op, left, right);
+}
+
+// Helper: Append a node to a list
+static void node_list_push(NodeList *list, ASTNode *node)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = (ASTNode **)realloc(list->items, sizeof(ASTNode *) * list->capacity);
+    }
+    list->items[list->count++] = node;
+}
+
 // Forward declarations
 static ASTNode *parse_statement(Parser *parser);
 static ASTNode *parse_block(Parser *parser);
 static ASTNode *parse_expression(Parser *parser);
+static ASTNode *parse_call(Parser *parser, const char *name);
+
+// Parse the argument list of a call to name: (expr, expr, ...)
+static ASTNode *parse_call(Parser *parser, const char *name)
+{
+    expect(parser, TOKEN_LPAREN, "Expected '(' to start arguments");
+
+    // Arguments collect on the scratch list above any enclosing list's
+    int mark = parser->scratch.count;
+    int height = 0;
+    while (!check(parser, TOKEN_RPAREN) && !check(parser, TOKEN_EOF))
+    {
+        if (parser->scratch.count > mark)
+            expect(parser, TOKEN_COMMA, "Expected ',' between arguments");
+        ASTNode *arg = parse_expression(parser);
+        node_list_push(&parser->scratch, arg);
+        if (parser->height > height)
+            height = parser->height;
+    }
+    expect(parser, TOKEN_RPAREN, "Expected ')' after arguments");
+    set_height(parser, height + 1);
+
+    ASTNode *call = ast_create_function_call(parser->ast, name, parser->scratch.items + mark,
+                                             parser->scratch.count - mark);
+    parser->scratch.count = mark;
+    return call;
+}
 
-// Parse a primary expression (string, number, identifier)
+// Parse a primary expression (string, number, identifier, call)
 static ASTNode *parse_primary(Parser *parser)
 {
+    parser->height = 1;
+
     if (check(parser, TOKEN_STRING))
     {
-        ASTNode *node = ast_create_string(parser->current_token->value);
+        ASTNode *node = ast_create_string(parser->ast, parser->current_token->value);
         advance(parser);
         return node;
     }
@@ -71,16 +161,18 @@ static ASTNode *parse_primary(Parser *parser)
     if (check(parser, TOKEN_NUMBER))
     {
         double value = atof(parser->current_token->value);
-        ASTNode *node = ast_create_number(value);
+        ASTNode *node = ast_create_number(parser->ast, value);
         advance(parser);
         return node;
     }
 
     if (check(parser, TOKEN_IDENTIFIER))
     {
-        ASTNode *node = ast_create_identifier(parser->current_token->value);
+        const char *name = parser->current_token->value;
         advance(parser);
-        return node;
+        if (check(parser, TOKEN_LPAREN))
+            return parse_call(parser, name);
+        return ast_create_identifier(parser->ast, name);
     }
 
     if (check(parser, TOKEN_LPAREN))
@@ -91,9 +183,30 @@ static ASTNode *parse_primary(Parser *parser)
         return expr;
     }
 
-    fprintf(stderr, "Parse error: Expected expression at line %d\n",
-            parser->current_token->line);
-    exit(1);
+    parse_error(parser, "Expected expression, got %s",
+                token_type_to_string(parser->current_token->type));
+    return error_node(parser);
+}
+
+// Map an operator token to its BinaryOperator
+static BinaryOperator token_operator(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_PLUS: return BINOP_ADD;
+    case TOKEN_MINUS: return BINOP_SUB;
+    case TOKEN_STAR: return BINOP_MUL;
+    case TOKEN_SLASH: return BINOP_DIV;
+    case TOKEN_LT: return BINOP_LT;
+    case TOKEN_GT: return BINOP_GT;
+    case TOKEN_LTE: return BINOP_LTE;
+    case TOKEN_GTE: return BINOP_GTE;
+    case TOKEN_EQ: return BINOP_EQ;
+    case TOKEN_NEQ: return BINOP_NEQ;
+    case TOKEN_AND: return BINOP_AND;
+    case TOKEN_OR: return BINOP_OR;
+    default: return BINOP_UNKNOWN;
+    }
 }
 
 // Parse multiplication and division
@@ -103,11 +216,11 @@ static ASTNode *parse_multiplicative(Parser *parser)
 
     while (check(parser, TOKEN_STAR) || check(parser, TOKEN_SLASH))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_primary(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
@@ -120,11 +233,11 @@ static ASTNode *parse_additive(Parser *parser)
 
     while (check(parser, TOKEN_PLUS) || check(parser, TOKEN_MINUS))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_multiplicative(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
@@ -138,11 +251,11 @@ static ASTNode *parse_comparison(Parser *parser)
     while (check(parser, TOKEN_LT) || check(parser, TOKEN_GT) ||
            check(parser, TOKEN_LTE) || check(parser, TOKEN_GTE))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_additive(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
@@ -155,11 +268,11 @@ static ASTNode *parse_equality(Parser *parser)
 
     while (check(parser, TOKEN_EQ) || check(parser, TOKEN_NEQ))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_comparison(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
@@ -172,48 +285,63 @@ static ASTNode *parse_and(Parser *parser)
 
     while (check(parser, TOKEN_AND))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_equality(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
 }
 
 // Parse logical OR (lowest precedence)
-static ASTNode *parse_expression(Parser *parser)
+static ASTNode *parse_or(Parser *parser)
 {
     ASTNode *left = parse_and(parser);
 
     while (check(parser, TOKEN_OR))
     {
-        char *op = strdup(parser->current_token->value);
+        BinaryOperator op = token_operator(parser->current_token->type);
+        int left_height = parser->height;
         advance(parser);
         ASTNode *right = parse_and(parser);
-        left = ast_create_binary_op(op, left, right);
-        free(op);
+        left = binary_node(parser, op, left, left_height, right);
     }
 
     return left;
 }
 
+// Parse a whole expression
+static ASTNode *parse_expression(Parser *parser)
+{
+    if (!enter(parser))
+        return error_node(parser);
+    ASTNode *node = parse_or(parser);
+    parser->depth--;
+    return node;
+}
+
 // Parse a block { ... }
 static ASTNode *parse_block(Parser *parser)
 {
+    if (!enter(parser))
+        return error_node(parser);
     expect(parser, TOKEN_LBRACE, "Expected '{' to start block");
 
-    ASTNode *block = ast_create_block();
-
+    int mark = parser->scratch.count;
     while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF))
     {
         ASTNode *stmt = parse_statement(parser);
-        ast_block_add_statement(block, stmt);
+        node_list_push(&parser->scratch, stmt);
     }
 
     expect(parser, TOKEN_RBRACE, "Expected '}' to end block");
 
+    ASTNode *block = ast_create_block(parser->ast, parser->scratch.items + mark,
+                                      parser->scratch.count - mark);
+    parser->scratch.count = mark;
+    parser->depth--;
     return block;
 }
 
@@ -237,23 +365,70 @@ static ASTNode *parse_response(Parser *parser)
         value = parse_expression(parser);
     }
 
-    return ast_create_response(value, is_html);
+    return ast_create_response(parser->ast, value, is_html);
+}
+
+// Parse an if statement; "else if" chains nest in the else branch
+static ASTNode *parse_if(Parser *parser)
+{
+    if (!enter(parser))
+        return error_node(parser);
+    expect(parser, TOKEN_IF, "Expected 'if'");
+
+    ASTNode *condition = parse_expression(parser);
+    ASTNode *then_branch = parse_block(parser);
+    ASTNode *else_branch = NULL;
+
+    if (check(parser, TOKEN_ELSE))
+    {
+        advance(parser);
+        else_branch = check(parser, TOKEN_IF) ? parse_if(parser) : parse_block(parser);
+    }
+
+    parser->depth--;
+    return ast_create_if(parser->ast, condition, then_branch, else_branch);
+}
+
+// Parse a while loop
+static ASTNode *parse_while(Parser *parser)
+{
+    expect(parser, TOKEN_WHILE, "Expected 'while'");
+
+    ASTNode *condition = parse_expression(parser);
+    ASTNode *body = parse_block(parser);
+
+    return ast_create_while(parser->ast, condition, body);
+}
+
+// Parse a return statement. There are no statement separators, so the
+// value is left out when a block end or statement keyword follows.
+static ASTNode *parse_return(Parser *parser)
+{
+    expect(parser, TOKEN_RETURN, "Expected 'return'");
+
+    int bare = check(parser, TOKEN_RBRACE) || check(parser, TOKEN_RESPONSE) ||
+               check(parser, TOKEN_IF) || check(parser, TOKEN_WHILE) ||
+               check(parser, TOKEN_RETURN);
+    ASTNode *value = bare ? NULL : parse_expression(parser);
+
+    return ast_create_return(parser->ast, value);
 }
 
 // Parse an assignment: name = value
 static ASTNode *parse_assignment(Parser *parser)
 {
-    char *name = strdup(parser->current_token->value);
+    const char *name = parser->current_token->value;
     advance(parser); // consume identifier
 
     expect(parser, TOKEN_EQUALS, "Expected '=' in assignment");
 
     ASTNode *value = parse_expression(parser);
 
-    return ast_create_assignment(name, value);
+    return ast_create_assignment(parser->ast, name, value);
 }
 
-// Parse a statement (assignment, response, or bare identifier)
+// Parse a statement (assignment, response, control flow, call, or bare
+// identifier)
 static ASTNode *parse_statement(Parser *parser)
 {
     if (check(parser, TOKEN_RESPONSE))
@@ -261,29 +436,46 @@ static ASTNode *parse_statement(Parser *parser)
         return parse_response(parser);
     }
 
+    if (check(parser, TOKEN_IF))
+    {
+        return parse_if(parser);
+    }
+
+    if (check(parser, TOKEN_WHILE))
+    {
+        return parse_while(parser);
+    }
+
+    if (check(parser, TOKEN_RETURN))
+    {
+        return parse_return(parser);
+    }
+
     if (check(parser, TOKEN_IDENTIFIER))
     {
-        // Peek ahead to see if it's an assignment
-        Token *next = peek_next(parser);
-        int is_assignment = (next->type == TOKEN_EQUALS);
-        token_free(next);
+        // Peek ahead to see if it's an assignment or a call
+        TokenType next_type = peek(parser, 1)->type;
 
-        if (is_assignment)
+        if (next_type == TOKEN_EQUALS)
         {
             return parse_assignment(parser);
         }
+        else if (next_type == TOKEN_LPAREN)
+        {
+            return parse_expression(parser);
+        }
         else
         {
             // Just a bare identifier
-            ASTNode *node = ast_create_identifier(parser->current_token->value);
+            ASTNode *node = ast_create_identifier(parser->ast, parser->current_token->value);
             advance(parser);
             return node;
         }
     }
 
-    fprintf(stderr, "Parse error: Unexpected token at line %d\n",
-            parser->current_token->line);
-    exit(1);
+    parse_error(parser, "Unexpected %s at the start of a statement",
+                token_type_to_string(parser->current_token->type));
+    return error_node(parser);
 }
 
 // Parse a route definition
@@ -291,32 +483,98 @@ static ASTNode *parse_route(Parser *parser)
 {
     expect(parser, TOKEN_ROUTE, "Expected 'route'");
 
-    if (!check(parser, TOKEN_STRING))
+    const char *path = "";
+    if (check(parser, TOKEN_STRING))
     {
-        fprintf(stderr, "Parse error: Expected route path string at line %d\n",
-                parser->current_token->line);
-        exit(1);
+        path = parser->current_token->value;
+        advance(parser);
+    }
+    else
+    {
+        parse_error(parser, "Expected route path string, got %s",
+                    token_type_to_string(parser->current_token->type));
     }
-
-    char *path = strdup(parser->current_token->value);
-    advance(parser);
 
     ASTNode *body = parse_block(parser);
 
-    return ast_create_route(path, body);
+    return ast_create_route(parser->ast, path, body);
+}
+
+// Parse a function definition: function name(a, b) { ... }
+static ASTNode *parse_function(Parser *parser)
+{
+    expect(parser, TOKEN_FUNCTION, "Expected 'function'");
+
+    const char *name = "";
+    if (check(parser, TOKEN_IDENTIFIER))
+    {
+        name = parser->current_token->value;
+        advance(parser);
+    }
+    else
+    {
+        parse_error(parser, "Expected function name, got %s",
+                    token_type_to_string(parser->current_token->type));
+    }
+
+    expect(parser, TOKEN_LPAREN, "Expected '(' after function name");
+    const char **params = NULL;
+    int param_count = 0;
+    while (!check(parser, TOKEN_RPAREN) && !check(parser, TOKEN_EOF))
+    {
+        if (param_count > 0)
+            expect(parser, TOKEN_COMMA, "Expected ',' between parameters");
+        if (!check(parser, TOKEN_IDENTIFIER))
+        {
+            parse_error(parser, "Expected parameter name, got %s",
+                        token_type_to_string(parser->current_token->type));
+            break;
+        }
+        params = (const char **)realloc(params, sizeof(char *) * (param_count + 1));
+        params[param_count++] = parser->current_token->value;
+        advance(parser);
+    }
+    expect(parser, TOKEN_RPAREN, "Expected ')' after parameters");
+
+    ASTNode *body = parse_block(parser);
+    ASTNode *function = ast_create_function(parser->ast, name, params, param_count, body);
+    free(params);
+    return function;
 }
 
 // Parse the entire program
 static ASTNode *parse_program(Parser *parser)
 {
     ASTNode *program = ast_create_program();
+    NodeList routes = {NULL, 0, 0};
+    NodeList functions = {NULL, 0, 0};
+    parser->ast = program->data.program.arena;
 
     while (!check(parser, TOKEN_EOF))
     {
+        // "memo" is only special in front of a top-level function, so it
+        // stays usable as a variable name
+        if (check(parser, TOKEN_IDENTIFIER) && strcmp(parser->current_token->value, "memo") == 0)
+        {
+            advance(parser);
+            ASTNode *function = parse_function(parser);
+            function->data.function.memo = 1;
+            node_list_push(&functions, function);
+            continue;
+        }
+        if (check(parser, TOKEN_FUNCTION))
+        {
+            node_list_push(&functions, parse_function(parser));
+            continue;
+        }
         ASTNode *route = parse_route(parser);
-        ast_program_add_route(program, route);
+        node_list_push(&routes, route);
     }
 
+    ast_program_set_functions(program, functions.items, functions.count);
+    ast_program_set_routes(program, routes.items, routes.count);
+    free(functions.items);
+    free(routes.items);
     return program;
 }
 
@@ -325,23 +583,39 @@ Parser *parser_init(Lexer *lexer)
 {
     Parser *parser = (Parser *)malloc(sizeof(Parser));
     parser->lexer = lexer;
-    parser->current_token = NULL;
-    advance(parser); // Get first token
+    diagnostics_init(&parser->diagnostics);
+    parser->failed = 0;
+    parser->depth = 0;
+    parser->height = 0;
+    lexer->diagnostics = &parser->diagnostics;
+    lexer_tokenize(lexer, &parser->tokens);
+    lexer->diagnostics = NULL;
+    parser->position = 0;
+    parser->current_token = &parser->tokens.tokens[0];
+    parser->ast = NULL;
+    parser->scratch.items = NULL;
+    parser->scratch.count = 0;
+    parser->scratch.capacity = 0;
     return parser;
 }
 
 // Free parser
 void parser_free(Parser *parser)
 {
-    if (parser->current_token)
-    {
-        token_free(parser->current_token);
-    }
+    token_list_free(&parser->tokens);
+    free(parser->scratch.items);
+    diagnostics_free(&parser->diagnostics);
     free(parser);
 }
 
 // Parse the program
 ASTNode *parser_parse(Parser *parser)
 {
-    return parse_program(parser);
+    ASTNode *program = parse_program(parser);
+    if (parser->diagnostics.count > 0)
+    {
+        ast_free(program);
+        return NULL;
+    }
+    return program;
 }
@@ -0,0 +1,317 @@
+#include "resolver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Names bound in the route or function being resolved; index = slot
+typedef struct {
+    const char **names;
+    int count;
+    int capacity;
+    ASTNode *program;    // For the function table
+} Scope;
+
+// Latest binding wins, so a repeated path parameter reads as its last
+// value. Names are interned, so they compare by pointer.
+static int scope_find(Scope *scope, const char *name)
+{
+    for (int i = scope->count - 1; i >= 0; i--)
+    {
+        if (scope->names[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+static int scope_add(Scope *scope, const char *name)
+{
+    if (scope->count == scope->capacity)
+    {
+        scope->capacity = scope->capacity ? scope->capacity * 2 : 8;
+        scope->names = (const char **)realloc(scope->names, sizeof(char *) * scope->capacity);
+    }
+    scope->names[scope->count] = name;
+    return scope->count++;
+}
+
+static int scope_bind(Scope *scope, const char *name)
+{
+    int slot = scope_find(scope, name);
+    return slot >= 0 ? slot : scope_add(scope, name);
+}
+
+// Bind ":name" segments of a route path, one slot each and in path order,
+// matching the order the router captures them in. Parameter names are
+// interned like every other name in the tree.
+static void bind_params(Scope *scope, InternTable *strings, const char *path)
+{
+    const char *p = path;
+    while (*p)
+    {
+        while (*p == '/')
+            p++;
+        size_t len = strcspn(p, "/");
+        if (len > 1 && p[0] == ':')
+            scope_add(scope, intern(strings, p + 1, len - 1));
+        p += len;
+    }
+}
+
+// Bindings first, so that reads of a name assigned anywhere in the route
+// resolve to its slot
+static void bind_assignments(Scope *scope, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case AST_ASSIGNMENT:
+        node->data.assignment.slot = scope_bind(scope, node->data.assignment.name);
+        break;
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            bind_assignments(scope, node->data.block.statements[i]);
+        }
+        break;
+    case AST_IF:
+        bind_assignments(scope, node->data.if_stmt.then_branch);
+        bind_assignments(scope, node->data.if_stmt.else_branch);
+        break;
+    case AST_WHILE:
+        bind_assignments(scope, node->data.while_stmt.body);
+        break;
+    default:
+        break;
+    }
+}
+
+// Calls are bound to their function once, here, rather than by name at
+// runtime. The first definition of a name wins.
+static ASTNode *find_function(ASTNode *program, const char *name)
+{
+    for (int i = 0; i < program->data.program.function_count; i++)
+    {
+        ASTNode *function = program->data.program.functions[i];
+        if (function->data.function.name == name)
+            return function;
+    }
+    return NULL;
+}
+
+static void resolve_reads(Scope *scope, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case AST_IDENTIFIER:
+        node->data.identifier.slot = scope_find(scope, node->data.identifier.name);
+        break;
+    case AST_ASSIGNMENT:
+        resolve_reads(scope, node->data.assignment.value);
+        break;
+    case AST_RESPONSE:
+        resolve_reads(scope, node->data.response.value);
+        break;
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            resolve_reads(scope, node->data.block.statements[i]);
+        }
+        break;
+    case AST_BINARY_OP:
+        resolve_reads(scope, node->data.binary_op.left);
+        resolve_reads(scope, node->data.binary_op.right);
+        break;
+    case AST_IF:
+        resolve_reads(scope, node->data.if_stmt.condition);
+        resolve_reads(scope, node->data.if_stmt.then_branch);
+        resolve_reads(scope, node->data.if_stmt.else_branch);
+        break;
+    case AST_WHILE:
+        resolve_reads(scope, node->data.while_stmt.condition);
+        resolve_reads(scope, node->data.while_stmt.body);
+        break;
+    case AST_RETURN:
+        resolve_reads(scope, node->data.return_stmt.value);
+        break;
+    case AST_FUNCTION_CALL:
+        node->data.function_call.target = find_function(scope->program, node->data.function_call.name);
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            resolve_reads(scope, node->data.function_call.args[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// A function body is pure if running it has no effect but its result:
+// it writes no response, reads no variable outside its own frame and calls
+// only defined, pure functions. Reports whether anything else makes it
+// impure; calls are checked by mark_purity.
+static int body_is_pure(ASTNode *node)
+{
+    if (!node)
+        return 1;
+
+    switch (node->type)
+    {
+    case AST_RESPONSE:
+        return 0;
+    case AST_IDENTIFIER:
+        return node->data.identifier.slot >= 0;
+    case AST_ASSIGNMENT:
+        return body_is_pure(node->data.assignment.value);
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            if (!body_is_pure(node->data.block.statements[i]))
+                return 0;
+        }
+        return 1;
+    case AST_BINARY_OP:
+        return body_is_pure(node->data.binary_op.left) && body_is_pure(node->data.binary_op.right);
+    case AST_IF:
+        return body_is_pure(node->data.if_stmt.condition) &&
+               body_is_pure(node->data.if_stmt.then_branch) &&
+               body_is_pure(node->data.if_stmt.else_branch);
+    case AST_WHILE:
+        return body_is_pure(node->data.while_stmt.condition) &&
+               body_is_pure(node->data.while_stmt.body);
+    case AST_RETURN:
+        return body_is_pure(node->data.return_stmt.value);
+    case AST_FUNCTION_CALL:
+        if (!node->data.function_call.target)
+            return 0;
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            if (!body_is_pure(node->data.function_call.args[i]))
+                return 0;
+        }
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+// Does the body call a function already known to be impure?
+static int calls_impure(ASTNode *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->type)
+    {
+    case AST_ASSIGNMENT:
+        return calls_impure(node->data.assignment.value);
+    case AST_BLOCK:
+        for (int i = 0; i < node->data.block.statement_count; i++)
+        {
+            if (calls_impure(node->data.block.statements[i]))
+                return 1;
+        }
+        return 0;
+    case AST_BINARY_OP:
+        return calls_impure(node->data.binary_op.left) || calls_impure(node->data.binary_op.right);
+    case AST_IF:
+        return calls_impure(node->data.if_stmt.condition) ||
+               calls_impure(node->data.if_stmt.then_branch) ||
+               calls_impure(node->data.if_stmt.else_branch);
+    case AST_WHILE:
+        return calls_impure(node->data.while_stmt.condition) ||
+               calls_impure(node->data.while_stmt.body);
+    case AST_RETURN:
+        return calls_impure(node->data.return_stmt.value);
+    case AST_FUNCTION_CALL:
+        if (!node->data.function_call.target->data.function.pure)
+            return 1;
+        for (int i = 0; i < node->data.function_call.arg_count; i++)
+        {
+            if (calls_impure(node->data.function_call.args[i]))
+                return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+// Assume every function that is pure on its own is pure, then drop those
+// calling an impure one until nothing changes, so recursion stays pure.
+// Only pure functions keep their memo annotation.
+static void mark_purity(ASTNode *program)
+{
+    int count = program->data.program.function_count;
+    for (int i = 0; i < count; i++)
+    {
+        ASTNode *function = program->data.program.functions[i];
+        function->data.function.pure = body_is_pure(function->data.function.body);
+    }
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int i = 0; i < count; i++)
+        {
+            ASTNode *function = program->data.program.functions[i];
+            if (function->data.function.pure && calls_impure(function->data.function.body))
+            {
+                function->data.function.pure = 0;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        ASTNode *function = program->data.program.functions[i];
+        if (function->data.function.memo && !function->data.function.pure)
+        {
+            fprintf(stderr, "Warning: memo function '%s' is not pure; its results won't be cached\n",
+                    function->data.function.name);
+            function->data.function.memo = 0;
+        }
+    }
+}
+
+void resolve_program(ASTNode *program)
+{
+    Scope scope = {NULL, 0, 0, program};
+
+    // Functions: parameters take the first slots, in order
+    for (int i = 0; i < program->data.program.function_count; i++)
+    {
+        ASTNode *function = program->data.program.functions[i];
+        function->data.function.index = i;
+
+        scope.count = 0;
+        for (int j = 0; j < function->data.function.param_count; j++)
+        {
+            scope_add(&scope, function->data.function.params[j]);
+        }
+        bind_assignments(&scope, function->data.function.body);
+        resolve_reads(&scope, function->data.function.body);
+        function->data.function.slot_count = scope.count;
+    }
+    mark_purity(program);
+
+    for (int i = 0; i < program->data.program.route_count; i++)
+    {
+        ASTNode *route = program->data.program.routes[i];
+
+        scope.count = 0;
+        bind_params(&scope, &program->data.program.arena->strings, route->data.route.path);
+        bind_assignments(&scope, route->data.route.body);
+        resolve_reads(&scope, route->data.route.body);
+        route->data.route.slot_count = scope.count;
+        route->data.route.resolved = 1;
+    }
+
+    free(scope.names);
+}
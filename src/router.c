@@ -0,0 +1,375 @@
+#include "router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ===== PATH SEGMENTS =====
+
+// Read the next non-empty segment at or after *pos. Empty segments are
+// skipped, so "/a//b/" and "/a/b" are the same path.
+static int next_segment(const char *path, size_t len, size_t *pos, StrView *segment)
+{
+    size_t i = *pos;
+    while (i < len && path[i] == '/')
+        i++;
+    if (i == len)
+    {
+        *pos = i;
+        return 0;
+    }
+
+    size_t start = i;
+    while (i < len && path[i] != '/')
+        i++;
+    *segment = strview_make(path + start, i - start);
+    *pos = i;
+    return 1;
+}
+
+static int compare_labels(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0)
+        return cmp;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+// ===== METHODS =====
+
+static const char *method_names[ROUTER_METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "*"};
+
+int router_parse_method(const char *name, size_t len)
+{
+    for (int i = 0; i < ROUTER_METHOD_ANY; i++)
+    {
+        if (strlen(method_names[i]) == len && memcmp(method_names[i], name, len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *router_method_name(int method)
+{
+    return method >= 0 && method < ROUTER_METHOD_COUNT ? method_names[method] : "?";
+}
+
+const char *router_split_method(const char *pattern, int *method)
+{
+    const char *space = strchr(pattern, ' ');
+    if (pattern[0] == '/' || !space)
+    {
+        *method = ROUTER_METHOD_ANY;
+        return pattern;
+    }
+
+    *method = router_parse_method(pattern, space - pattern);
+    while (*space == ' ')
+        space++;
+    return space;
+}
+
+// ===== COMPILATION =====
+
+// Pointer-based trie used while inserting routes, flattened afterwards
+typedef struct BuildNode {
+    const char *label;
+    size_t label_len;
+    struct BuildNode **children;
+    int child_count;
+    struct BuildNode *param;
+    int routes[ROUTER_METHOD_COUNT];
+} BuildNode;
+
+static BuildNode *build_node_create(const char *label, size_t label_len)
+{
+    BuildNode *node = (BuildNode *)malloc(sizeof(BuildNode));
+    node->label = label;
+    node->label_len = label_len;
+    node->children = NULL;
+    node->child_count = 0;
+    node->param = NULL;
+    for (int i = 0; i < ROUTER_METHOD_COUNT; i++)
+    {
+        node->routes[i] = -1;
+    }
+    return node;
+}
+
+static void build_node_free(BuildNode *node)
+{
+    if (!node)
+        return;
+    for (int i = 0; i < node->child_count; i++)
+    {
+        build_node_free(node->children[i]);
+    }
+    free(node->children);
+    build_node_free(node->param);
+    free(node);
+}
+
+static int build_node_compare(const void *a, const void *b)
+{
+    const BuildNode *x = *(const BuildNode *const *)a;
+    const BuildNode *y = *(const BuildNode *const *)b;
+    return compare_labels(x->label, x->label_len, y->label, y->label_len);
+}
+
+static uint32_t add_string(Router *router, const char *str, size_t len)
+{
+    uint32_t offset = router->strings_len;
+    router->strings = (char *)realloc(router->strings, router->strings_len + len + 1);
+    memcpy(router->strings + offset, str, len);
+    router->strings[offset + len] = '\0';
+    router->strings_len += len + 1;
+    return offset;
+}
+
+// Add one route's pattern to the build trie and record its parameter names
+static int insert_route(Router *router, BuildNode *root, const char *pattern, int route_index)
+{
+    RouterRoute *route = &router->routes[route_index];
+    route->first_param = router->param_count;
+    route->param_count = 0;
+
+    int method;
+    const char *path = router_split_method(pattern, &method);
+    if (method < 0)
+    {
+        fprintf(stderr, "Route '%s' has an unsupported method; ignoring it\n", pattern);
+        return 0;
+    }
+
+    BuildNode *node = root;
+    size_t len = strlen(path);
+    size_t pos = 0;
+    StrView segment;
+
+    while (next_segment(path, len, &pos, &segment))
+    {
+        if (segment.data[0] == ':' && segment.len > 1)
+        {
+            if (route->param_count == ROUTER_MAX_PARAMS)
+            {
+                fprintf(stderr, "Route '%s' has more than %d parameters; ignoring it\n",
+                        pattern, ROUTER_MAX_PARAMS);
+                router->param_count = route->first_param;
+                return 0;
+            }
+            router->params = (RouterParam *)realloc(router->params,
+                                                    sizeof(RouterParam) * (router->param_count + 1));
+            RouterParam *param = &router->params[router->param_count++];
+            param->name = add_string(router, segment.data + 1, segment.len - 1);
+            param->name_len = segment.len - 1;
+            route->param_count++;
+
+            if (!node->param)
+                node->param = build_node_create(NULL, 0);
+            node = node->param;
+            continue;
+        }
+
+        BuildNode *child = NULL;
+        for (int i = 0; i < node->child_count; i++)
+        {
+            if (compare_labels(node->children[i]->label, node->children[i]->label_len,
+                               segment.data, segment.len) == 0)
+            {
+                child = node->children[i];
+                break;
+            }
+        }
+        if (!child)
+        {
+            child = build_node_create(segment.data, segment.len);
+            node->children = (BuildNode **)realloc(node->children,
+                                                   sizeof(BuildNode *) * (node->child_count + 1));
+            node->children[node->child_count++] = child;
+        }
+        node = child;
+    }
+
+    // The first definition of a method + pattern wins
+    if (node->routes[method] < 0)
+        node->routes[method] = route_index;
+    return 1;
+}
+
+// Lay the build trie out breadth-first so each node's static children end
+// up contiguous (and sorted) in router->nodes
+static void flatten(Router *router, BuildNode *root, uint32_t total)
+{
+    BuildNode **queue = (BuildNode **)malloc(sizeof(BuildNode *) * total);
+    uint32_t head = 0, tail = 0;
+
+    router->nodes = (RouterNode *)malloc(sizeof(RouterNode) * total);
+    queue[tail++] = root;
+
+    while (head < tail)
+    {
+        uint32_t index = head;
+        BuildNode *build = queue[head++];
+        RouterNode *node = &router->nodes[index];
+
+        node->label = build->label ? add_string(router, build->label, build->label_len) : 0;
+        node->label_len = build->label_len;
+        node->methods = 0;
+        for (int i = 0; i < ROUTER_METHOD_COUNT; i++)
+        {
+            node->routes[i] = build->routes[i];
+            if (build->routes[i] >= 0)
+                node->methods |= 1u << i;
+        }
+
+        qsort(build->children, build->child_count, sizeof(BuildNode *), build_node_compare);
+        node->first_child = tail;
+        node->child_count = build->child_count;
+        for (int i = 0; i < build->child_count; i++)
+        {
+            queue[tail++] = build->children[i];
+        }
+
+        node->param_child = -1;
+        if (build->param)
+        {
+            node->param_child = tail;
+            queue[tail++] = build->param;
+        }
+    }
+
+    router->node_count = tail;
+    free(queue);
+}
+
+static uint32_t count_nodes(BuildNode *node)
+{
+    uint32_t count = 1;
+    for (int i = 0; i < node->child_count; i++)
+    {
+        count += count_nodes(node->children[i]);
+    }
+    if (node->param)
+        count += count_nodes(node->param);
+    return count;
+}
+
+Router *router_compile(ASTNode *program)
+{
+    Router *router = (Router *)calloc(1, sizeof(Router));
+    int route_count = program->data.program.route_count;
+
+    router->route_count = route_count;
+    router->routes = (RouterRoute *)calloc(route_count > 0 ? route_count : 1, sizeof(RouterRoute));
+
+    BuildNode *root = build_node_create(NULL, 0);
+    for (int i = 0; i < route_count; i++)
+    {
+        insert_route(router, root, program->data.program.routes[i]->data.route.path, i);
+    }
+
+    flatten(router, root, count_nodes(root));
+    build_node_free(root);
+    return router;
+}
+
+void router_free(Router *router)
+{
+    if (!router)
+        return;
+    free(router->nodes);
+    free(router->routes);
+    free(router->params);
+    free(router->strings);
+    free(router);
+}
+
+// ===== MATCHING =====
+
+// Index of node's static child labelled segment, or -1. Static children
+// are sorted, so this is a binary search.
+static int32_t find_child(const Router *router, const RouterNode *node, StrView segment)
+{
+    uint32_t lo = node->first_child;
+    uint32_t hi = node->first_child + node->child_count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const RouterNode *child = &router->nodes[mid];
+        int cmp = compare_labels(segment.data, segment.len,
+                                 router->strings + child->label, child->label_len);
+        if (cmp == 0)
+            return (int32_t)mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+// Walk the trie one segment at a time. A static child matching the segment
+// always wins over a parameter, and the walk never comes back to try the
+// parameter instead, so matching takes one step per segment however the
+// routes overlap. The node the path ends at decides: if it has no route
+// for the method, its methods are the Allow set for a 405 response. HEAD
+// without a route of its own is answered by the GET route (the server
+// drops the body).
+static int match_path(const Router *router, int method, const char *path, size_t len,
+                      RouteMatch *match)
+{
+    const RouterNode *node = &router->nodes[0];
+    size_t pos = 0;
+    StrView segment;
+
+    while (next_segment(path, len, &pos, &segment))
+    {
+        int32_t child = find_child(router, node, segment);
+        if (child < 0)
+        {
+            if (node->param_child < 0 || match->param_count == ROUTER_MAX_PARAMS)
+                return 0;
+            match->params[match->param_count++].value = segment;
+            child = node->param_child;
+        }
+        node = &router->nodes[child];
+    }
+
+    int route = method >= 0 ? node->routes[method] : -1;
+    if (route < 0 && method == ROUTER_METHOD_HEAD)
+        route = node->routes[ROUTER_METHOD_GET];
+    if (route < 0)
+        route = node->routes[ROUTER_METHOD_ANY];
+    if (route < 0)
+    {
+        match->allowed = node->methods;
+        return 0;
+    }
+    match->route = route;
+    return 1;
+}
+
+RouterResult router_match(const Router *router, int method, const char *path, size_t path_len,
+                          RouteMatch *match)
+{
+    match->route = -1;
+    match->param_count = 0;
+    match->allowed = 0;
+
+    if (router->node_count == 0 || !match_path(router, method, path, path_len, match))
+    {
+        if (match->allowed & (1u << ROUTER_METHOD_GET))
+            match->allowed |= 1u << ROUTER_METHOD_HEAD;
+        return match->allowed ? ROUTER_METHOD_NOT_ALLOWED : ROUTER_NOT_FOUND;
+    }
+
+    // Captured values are in path order, which is also the order of the
+    // matched route's parameter names
+    const RouterRoute *route = &router->routes[match->route];
+    for (int i = 0; i < match->param_count; i++)
+    {
+        const RouterParam *param = &router->params[route->first_param + i];
+        match->params[i].name = strview_make(router->strings + param->name, param->name_len);
+    }
+    return ROUTER_MATCHED;
+}
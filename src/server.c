@@ -1,39 +1,103 @@
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
+#include "optimizer.h"
+#include "resolver.h"
 #include "http_server.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 // Global server for signal handling
 HTTPServer *global_server = NULL;
 
-// Signal handler for graceful shutdown
+// Signal handler for graceful shutdown; http_server_start returns once
+// every worker has left its event loop
 void signal_handler(int signum)
 {
-    printf("\n\nShutting down server...\n");
+    (void)signum;
     if (global_server)
     {
         http_server_stop(global_server);
-        http_server_free(global_server);
     }
-    exit(0);
 }
 
 int main(int argc, char *argv[])
 {
     int port = 8080;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int quiet = 0;
+    int use_vm = 1;
+    int max_call_depth = INTERPRETER_MAX_CALL_DEPTH;
+    int memo_entries = MEMO_DEFAULT_ENTRIES;
+    int reload = 1;
+    const char *program_path = NULL;
 
-    // Check for port argument
-    if (argc > 1)
+    // Usage: webbubble-server [port] [app.bub | app.bubc] [--workers N] [--quiet] [--no-vm]
+    //                         [--max-call-depth N] [--memo-entries N] [--no-reload]
+    // A program file, source or image (see "webbubble compile"), is reloaded
+    // whenever it changes; without one the built-in example is served.
+    for (int i = 1; i < argc; i++)
     {
-        port = atoi(argv[1]);
-        if (port <= 0 || port > 65535)
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            workers = atoi(argv[++i]);
+            if (workers <= 0)
+            {
+                fprintf(stderr, "Invalid worker count. Using 1\n");
+                workers = 1;
+            }
+        }
+        else if (strcmp(argv[i], "--quiet") == 0)
+        {
+            quiet = 1;
+        }
+        else if (strcmp(argv[i], "--no-vm") == 0)
+        {
+            use_vm = 0;
+        }
+        else if (strcmp(argv[i], "--no-reload") == 0)
         {
-            fprintf(stderr, "Invalid port number. Using default: 8080\n");
-            port = 8080;
+            reload = 0;
         }
+        else if (strcmp(argv[i], "--max-call-depth") == 0 && i + 1 < argc)
+        {
+            max_call_depth = atoi(argv[++i]);
+            if (max_call_depth <= 0)
+            {
+                fprintf(stderr, "Invalid call depth. Using default: %d\n", INTERPRETER_MAX_CALL_DEPTH);
+                max_call_depth = INTERPRETER_MAX_CALL_DEPTH;
+            }
+        }
+        else if (strcmp(argv[i], "--memo-entries") == 0 && i + 1 < argc)
+        {
+            memo_entries = atoi(argv[++i]);
+            if (memo_entries < 0)
+            {
+                fprintf(stderr, "Invalid memo cache size. Using default: %d\n", MEMO_DEFAULT_ENTRIES);
+                memo_entries = MEMO_DEFAULT_ENTRIES;
+            }
+        }
+        else if (!isdigit((unsigned char)argv[i][0]))
+        {
+            program_path = argv[i];
+        }
+        else
+        {
+            port = atoi(argv[i]);
+            if (port <= 0 || port > 65535)
+            {
+                fprintf(stderr, "Invalid port number. Using default: 8080\n");
+                port = 8080;
+            }
+        }
+    }
+    if (workers <= 0)
+    {
+        workers = 1;
     }
 
     // Example WebBubble code
@@ -81,25 +145,57 @@ int main(int argc, char *argv[])
         "    status = \"OK\"\n"
         "    uptime = 100\n"
         "    response status\n"
+        "}\n"
+        "\n"
+        "route \"POST /api/echo\" {\n"
+        "    response \"Echo received\"\n"
         "}\n";
 
     printf("=== WebBubble HTTP Server ===\n\n");
-    printf("Parsing program...\n");
 
-    // Create lexer and parser
-    Lexer *lexer = lexer_init(source);
-    Parser *parser = parser_init(lexer);
+    ASTNode *ast = NULL;
+    if (program_path)
+    {
+        // The server owns programs loaded from files, reloads included
+        printf("Loading %s...\n", program_path);
+        global_server = http_server_create_from_file(port, program_path);
+        if (!global_server)
+            return 1;
+        if (!use_vm && global_server->current->image)
+            fprintf(stderr, "--no-vm has no effect on an image; using the VM\n");
+    }
+    else
+    {
+        printf("Parsing program...\n");
+
+        // Create lexer and parser
+        Lexer *lexer = lexer_init(source);
+        Parser *parser = parser_init(lexer);
+
+        // Parse the program
+        ast = parser_parse(parser);
+        diagnostics_print(&parser->diagnostics, "example", stderr);
 
-    // Parse the program
-    ASTNode *ast = parser_parse(parser);
-    printf("Parse successful!\n");
+        // Cleanup parser and lexer (keep AST)
+        parser_free(parser);
+        lexer_free(lexer);
+        if (!ast)
+            return 1;
 
-    // Cleanup parser and lexer (keep AST)
-    parser_free(parser);
-    lexer_free(lexer);
+        optimize_program(ast);
+        resolve_program(ast);
+        printf("Parse successful!\n");
 
-    // Create and start HTTP server
-    global_server = http_server_create(port, ast);
+        global_server = http_server_create(port, ast);
+    }
+
+    // Start HTTP server
+    http_server_set_workers(global_server, (int)workers);
+    global_server->log_requests = !quiet;
+    global_server->use_bytecode = use_vm;
+    global_server->max_call_depth = max_call_depth;
+    global_server->memo_entries = memo_entries;
+    global_server->reload = reload;
 
     // Setup signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);
@@ -108,7 +204,9 @@ int main(int argc, char *argv[])
     // Start the server (this blocks)
     http_server_start(global_server);
 
-    // Cleanup (only reached if server stops)
+    // Cleanup once the server has stopped
+    printf("\n\nShutting down server...\n");
+    http_server_print_cache_stats(global_server);
     http_server_free(global_server);
     ast_free(ast);
 
@@ -0,0 +1,345 @@
+#include "bytecode.h"
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Threaded dispatch: with GCC/Clang each handler jumps straight to the
+// next one through a label table (computed goto), which gives the branch
+// predictor one indirect jump per handler instead of a single shared one.
+// Other compilers get a plain switch loop.
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+#define STRING_CONSTANT(program, index) ((char *)(program)->pool + (program)->strings[index])
+
+// Run a route body whose frame is at frame, with operands from sp up.
+// Calls don't recurse in C: the caller's ip and frame are pushed on
+// interp->calls, and the callee's frame starts at the arguments already on
+// the caller's operand stack. Stack overflow aborts the route.
+static void vm_run(const BytecodeProgram *program, const Instruction *ip, Value *frame, Value *sp,
+                   Interpreter *interp)
+{
+    Arena *arena = &interp->arena;
+    Value *stack_end = interp->stack + interp->stack_size;
+    CallFrame *calls = interp->calls;
+    int depth = 0;
+    const MemoKey *memo_key;
+    Instruction ins;
+
+    // Every value on the stack is a number, a bool, null or a borrowed
+    // string (constant pool, frame or arena), so nothing is ever freed here
+
+#ifdef VM_COMPUTED_GOTO
+    static const void *labels[OP_COUNT] = {
+#define VM_LABEL(op) &&L_##op,
+        BYTECODE_OPS(VM_LABEL)
+#undef VM_LABEL
+    };
+#define VM_CASE(op) L_##op:
+#define VM_NEXT()                          \
+    do                                     \
+    {                                      \
+        ins = *ip++;                       \
+        goto *labels[INSTR_OP(ins)];       \
+    } while (0)
+
+    VM_NEXT();
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT() continue
+
+    for (;;)
+    {
+        ins = *ip++;
+        switch (INSTR_OP(ins))
+        {
+#endif
+
+    VM_CASE(OP_PUSH_STRING)
+    {
+        *sp++ = value_borrow_string(STRING_CONSTANT(program, INSTR_ARG(ins)));
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_PUSH_NUMBER)
+    {
+        *sp++ = value_create_number(program->numbers[INSTR_ARG(ins)]);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_PUSH_NULL)
+    {
+        *sp++ = value_create_null();
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_PUSH_BOOL)
+    {
+        *sp++ = value_create_bool((int)INSTR_ARG(ins));
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_POP)
+    {
+        sp--;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_LOAD)
+    {
+        *sp++ = frame[INSTR_ARG(ins)];
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_STORE)
+    {
+        frame[INSTR_ARG(ins)] = *--sp;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_LOAD_NAME)
+    {
+        const char *name = STRING_CONSTANT(program, INSTR_ARG(ins));
+        Value *var = get_variable(interp, name);
+        if (!var)
+            fprintf(stderr, "Runtime error: Undefined variable '%s'\n", name);
+        *sp++ = var ? *var : value_create_null();
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_STORE_NAME)
+    {
+        set_variable(interp, STRING_CONSTANT(program, INSTR_ARG(ins)), *--sp);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_APPEND_NAME)
+    {
+        Value *var = get_variable(interp, STRING_CONSTANT(program, INSTR_ARG(ins)));
+        if (var)
+            sp[-1] = value_concat(arena, &sp[-1], var);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_CONCAT)
+    {
+        sp--;
+        sp[-1] = value_concat(arena, &sp[-1], sp);
+        VM_NEXT();
+    }
+
+    // Arithmetic and comparisons take a fast path when both operands are
+    // numbers and defer to the shared operator semantics otherwise
+#define VM_NUMERIC(op, binop, make, expr)                                   \
+    VM_CASE(op)                                                             \
+    {                                                                       \
+        Value *a = sp - 2, *b = sp - 1;                                     \
+        if (a->type == VAL_NUMBER && b->type == VAL_NUMBER)                 \
+            *a = make(a->data.number expr b->data.number);                  \
+        else                                                                \
+            *a = value_binary_op(arena, binop, a, b);                       \
+        sp--;                                                               \
+        VM_NEXT();                                                          \
+    }
+
+    VM_NUMERIC(OP_ADD, BINOP_ADD, value_create_number, +)
+    VM_NUMERIC(OP_SUB, BINOP_SUB, value_create_number, -)
+    VM_NUMERIC(OP_MUL, BINOP_MUL, value_create_number, *)
+    VM_NUMERIC(OP_LT, BINOP_LT, value_create_bool, <)
+    VM_NUMERIC(OP_GT, BINOP_GT, value_create_bool, >)
+    VM_NUMERIC(OP_LTE, BINOP_LTE, value_create_bool, <=)
+    VM_NUMERIC(OP_GTE, BINOP_GTE, value_create_bool, >=)
+    VM_NUMERIC(OP_EQ, BINOP_EQ, value_create_bool, ==)
+    VM_NUMERIC(OP_NEQ, BINOP_NEQ, value_create_bool, !=)
+#undef VM_NUMERIC
+
+    VM_CASE(OP_DIV)
+    {
+        // Division by zero goes the slow way for its error message
+        Value *a = sp - 2, *b = sp - 1;
+        if (a->type == VAL_NUMBER && b->type == VAL_NUMBER && b->data.number != 0)
+            *a = value_create_number(a->data.number / b->data.number);
+        else
+            *a = value_binary_op(arena, BINOP_DIV, a, b);
+        sp--;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_BINARY)
+    {
+        sp--;
+        sp[-1] = value_binary_op(arena, (BinaryOperator)INSTR_ARG(ins), &sp[-1], sp);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_RESPOND)
+    {
+        sp--;
+        interpreter_respond(interp, sp, 0);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_RESPOND_HTML)
+    {
+        sp--;
+        interpreter_respond(interp, sp, 1);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_JUMP)
+    {
+        ip += INSTR_SARG(ins);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_JUMP_IF_FALSE)
+    {
+        sp--;
+        if (!value_truthy(sp))
+            ip += INSTR_SARG(ins);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_JUMP_IF_TRUE)
+    {
+        sp--;
+        if (value_truthy(sp))
+            ip += INSTR_SARG(ins);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_CALL_MEMO)
+    {
+        memo_key = NULL;
+        if (interp->memo)
+        {
+            const BytecodeFunction *function = &program->functions[INSTR_ARG(ins)];
+            Value *args = sp - function->param_count;
+            MemoKey *key = memo_key_create(arena, INSTR_ARG(ins), args, (int)function->param_count);
+            Value result;
+            if (memo_cache_lookup(interp->memo, key, arena, &result))
+            {
+                sp = args;
+                *sp++ = result;
+                VM_NEXT();
+            }
+            memo_key = key;
+        }
+        goto call;
+    }
+
+    VM_CASE(OP_CALL)
+    {
+        memo_key = NULL;
+    call:;
+        const BytecodeFunction *function = &program->functions[INSTR_ARG(ins)];
+        Value *callee = sp - function->param_count;
+        if (depth == interp->max_call_depth)
+        {
+            interpreter_abort(interp, "Call depth limit (%d) exceeded calling '%s'",
+                              interp->max_call_depth, STRING_CONSTANT(program, function->name));
+            return;
+        }
+        if (callee + function->slot_count + function->max_stack > stack_end)
+        {
+            interpreter_abort(interp, "Out of stack space calling '%s'",
+                              STRING_CONSTANT(program, function->name));
+            return;
+        }
+
+        calls[depth].return_ip = ip;
+        calls[depth].frame = frame;
+        calls[depth].memo = memo_key;
+        depth++;
+
+        frame = callee;
+        for (uint32_t i = function->param_count; i < function->slot_count; i++)
+        {
+            frame[i] = value_create_null();
+        }
+        sp = frame + function->slot_count;
+        ip = program->code + function->code_start;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_TAILCALL)
+    {
+        // "return f(...)": f's arguments replace this frame, and f returns
+        // straight to our caller
+        const BytecodeFunction *function = &program->functions[INSTR_ARG(ins)];
+        Value *args = sp - function->param_count;
+        if (frame + function->slot_count + function->max_stack > stack_end)
+        {
+            interpreter_abort(interp, "Out of stack space calling '%s'",
+                              STRING_CONSTANT(program, function->name));
+            return;
+        }
+
+        memmove(frame, args, sizeof(Value) * function->param_count);
+        for (uint32_t i = function->param_count; i < function->slot_count; i++)
+        {
+            frame[i] = value_create_null();
+        }
+        sp = frame + function->slot_count;
+        ip = program->code + function->code_start;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_CALL_MISSING)
+    {
+        fprintf(stderr, "Runtime error: Undefined function '%s'\n",
+                STRING_CONSTANT(program, INSTR_ARG(ins)));
+        *sp++ = value_create_null();
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_RETURN)
+    {
+        // A return in the route body itself ends the route
+        if (depth == 0)
+            return;
+
+        // The callee's frame began where its arguments were pushed, which
+        // is where the caller expects the result
+        Value result = sp[-1];
+        sp = frame;
+        *sp++ = result;
+        depth--;
+        if (calls[depth].memo)
+            memo_cache_store(interp->memo, calls[depth].memo, &result);
+        frame = calls[depth].frame;
+        ip = calls[depth].return_ip;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_HALT)
+    {
+        return;
+    }
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            return;
+        }
+    }
+#endif
+}
+
+void vm_execute(const BytecodeProgram *program, uint32_t route_index, Interpreter *interp)
+{
+    const BytecodeRoute *route = &program->routes[route_index];
+
+    // The route's frame is at the bottom of the stack; make sure its
+    // operands fit above it
+    if (interp->stack_top + (int)route->max_stack > interp->stack_size)
+    {
+        interp->stack_size = interp->stack_top + route->max_stack + INTERPRETER_STACK_SLOTS;
+        interp->stack = (Value *)realloc(interp->stack, sizeof(Value) * interp->stack_size);
+        interp->frame = interp->stack;
+    }
+
+    vm_run(program, program->code + route->code_start, interp->frame,
+           interp->stack + interp->stack_top, interp);
+}
@@ -0,0 +1,49 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include <stdio.h>
+
+// Minimal checks for the test programs in tests/: a failed CHECK prints
+// where it was and the run continues, and TEST_RESULT at the end of main
+// turns the failures into the exit status.
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                              \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                     \
+        }                                                                        \
+    } while (0)
+
+#define TEST_RESULT()                                                            \
+    (test_failures ? (fprintf(stderr, "%d check%s failed\n", test_failures,     \
+                              test_failures == 1 ? "" : "s"), 1)                 \
+                   : (printf("All checks passed\n"), 0))
+
+// Parse, optimize and resolve a program as the server does; NULL, with the
+// errors on stderr, if it doesn't parse
+static inline ASTNode *parse_program(const char *source)
+{
+    Lexer *lexer = lexer_init(source);
+    Parser *parser = parser_init(lexer);
+    ASTNode *ast = parser_parse(parser);
+    diagnostics_print(&parser->diagnostics, "test", stderr);
+    parser_free(parser);
+    lexer_free(lexer);
+    if (ast)
+    {
+        optimize_program(ast);
+        resolve_program(ast);
+    }
+    return ast;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "test.h"
+#include "http_parser.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Parse a whole request held in a string; the parser may write to the
+// buffer (chunked bodies are decoded in place)
+static HTTPParseStatus parse(const char *raw, HTTPRequest *request)
+{
+    static char buf[4096];
+    size_t len = strlen(raw);
+    memcpy(buf, raw, len);
+    http_request_init(request);
+    return http_request_parse(request, buf, len);
+}
+
+// Parse a chunked "hello" request sent with the given Transfer-Encoding;
+// returns 200 if it parsed, or the status the server would reject it with
+static int transfer_encoding_status(const char *value)
+{
+    char raw[512];
+    snprintf(raw, sizeof(raw),
+             "POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: %s\r\n\r\n"
+             "5\r\nhello\r\n0\r\n\r\n",
+             value);
+
+    HTTPRequest request;
+    HTTPParseStatus status = parse(raw, &request);
+    if (status == HTTP_PARSE_ERROR)
+        return request.error_status;
+    if (status != HTTP_PARSE_COMPLETE || !request.chunked || !strview_equals(request.body, "hello"))
+        return 0;
+    return 200;
+}
+
+static void check_transfer_encoding()
+{
+    CHECK(transfer_encoding_status("chunked") == 200);
+    CHECK(transfer_encoding_status("Chunked") == 200);
+    CHECK(transfer_encoding_status(" , chunked ,") == 200);
+
+    // Codings other than chunked are never decoded
+    CHECK(transfer_encoding_status("xchunked") == 501);
+    CHECK(transfer_encoding_status("gzip, chunked") == 501);
+    CHECK(transfer_encoding_status("gzip;q=1") == 501);
+
+    CHECK(transfer_encoding_status("chunked, chunked") == 400);
+    CHECK(transfer_encoding_status("chunked;ext=1") == 400);
+    CHECK(transfer_encoding_status("chu nked") == 400);
+    CHECK(transfer_encoding_status(",") == 400);
+}
+
+// Feed raw to the parser a few bytes at a time into a buffer of cap bytes,
+// compacting after each incomplete parse as the server does. Returns the
+// final status, or HTTP_PARSE_INCOMPLETE if raw didn't fit, and sets *len to
+// the bytes left in buf.
+static HTTPParseStatus parse_compacted(const char *raw, size_t raw_len, char *buf, size_t cap,
+                                       HTTPRequest *request, size_t *len)
+{
+    size_t sent = 0;
+    *len = 0;
+    http_request_init(request);
+    while (1)
+    {
+        size_t n = raw_len - sent < 7 ? raw_len - sent : 7;
+        if (n > cap - *len)
+            return HTTP_PARSE_INCOMPLETE;
+        memcpy(buf + *len, raw + sent, n);
+        *len += n;
+        sent += n;
+        HTTPParseStatus status = http_request_parse(request, buf, *len);
+        if (status != HTTP_PARSE_INCOMPLETE || sent == raw_len)
+            return status;
+        *len = http_request_compact(request, buf, *len);
+    }
+}
+
+static void check_chunk_framing()
+{
+    // A body sent in one-byte chunks has five bytes of framing per data
+    // byte, yet fits in a buffer not much bigger than the decoded body
+    const char *head = "POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n";
+    size_t body_len = 1000;
+    size_t raw_len = strlen(head) + body_len * 6 + 5;
+    char *raw = (char *)malloc(raw_len + 1);
+    char *p = raw + sprintf(raw, "%s", head);
+    for (size_t i = 0; i < body_len; i++)
+        p += sprintf(p, "1\r\n%c\r\n", 'a' + (int)(i % 26));
+    sprintf(p, "0\r\n\r\n");
+
+    char buf[1200];
+    HTTPRequest request;
+    size_t len;
+    CHECK(parse_compacted(raw, raw_len, buf, sizeof(buf), &request, &len) == HTTP_PARSE_COMPLETE);
+    CHECK(request.body.len == body_len);
+    CHECK(request.body.data[0] == 'a' && request.body.data[body_len - 1] == (char)('a' + (body_len - 1) % 26));
+    CHECK(request.length == len); // Where a pipelined request would start
+    free(raw);
+
+    // Framing has its own limit, apart from the body's
+    size_t ext_len = 1000;
+    size_t chunks = HTTP_MAX_FRAMING_BYTES / ext_len + 1;
+    raw = (char *)malloc(strlen(head) + chunks * (ext_len + 8) + 6);
+    p = raw + sprintf(raw, "%s", head);
+    for (size_t i = 0; i < chunks; i++)
+    {
+        p += sprintf(p, "1;");
+        memset(p, 'x', ext_len - 2);
+        p += ext_len - 2;
+        p += sprintf(p, "\r\na\r\n");
+    }
+    p += sprintf(p, "0\r\n\r\n");
+
+    char *big = (char *)malloc(p - raw);
+    CHECK(parse_compacted(raw, p - raw, big, p - raw, &request, &len) == HTTP_PARSE_ERROR);
+    CHECK(request.error_status == 413);
+    free(big);
+    free(raw);
+}
+
+int main()
+{
+    check_transfer_encoding();
+    check_chunk_framing();
+    return TEST_RESULT();
+}
@@ -0,0 +1,174 @@
+#include "test.h"
+#include "http_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Runs a server on a local port and talks raw HTTP to it
+
+static const char *source =
+    "route \"/\" {\n"
+    "    response \"Welcome\"\n"
+    "}\n"
+    "\n"
+    "route \"/hello/:name\" {\n"
+    "    response \"Hello, \" + name\n"
+    "}\n"
+    "\n"
+    "route \"GET /posts\" {\n"
+    "    response \"list\"\n"
+    "}\n"
+    "\n"
+    "route \"POST /upload\" {\n"
+    "    response \"stored\"\n"
+    "}\n";
+
+static int port;
+
+static void *server_run(void *arg)
+{
+    http_server_start((HTTPServer *)arg);
+    return NULL;
+}
+
+// Send request on a new connection and read until the server closes it.
+// Returns the bytes received, NUL-terminated; the caller frees them.
+static char *exchange(const char *request, size_t *len)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // The server may still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+            break;
+        close(fd);
+        fd = -1;
+        usleep(20 * 1000);
+    }
+    *len = 0;
+    if (fd < 0)
+        return strdup("");
+
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    send(fd, request, strlen(request), MSG_NOSIGNAL);
+
+    size_t cap = 4096;
+    char *buf = (char *)malloc(cap);
+    ssize_t n;
+    while ((n = recv(fd, buf + *len, cap - *len - 1, 0)) > 0)
+    {
+        *len += (size_t)n;
+        if (cap - *len == 1)
+            buf = (char *)realloc(buf, cap *= 2);
+    }
+    buf[*len] = '\0';
+    close(fd);
+    return buf;
+}
+
+// Length of the status line and headers at data, blank line included, or 0
+static size_t head_length(const char *data)
+{
+    const char *end = strstr(data, "\r\n\r\n");
+    return end ? (size_t)(end - data) + 4 : 0;
+}
+
+// Content-Length of the response whose head is at data, or -1 without one
+static long content_length(const char *data, size_t head_len)
+{
+    const char *header = strstr(data, "Content-Length: ");
+    if (!header || (size_t)(header - data) >= head_len)
+        return -1;
+    return atol(header + strlen("Content-Length: "));
+}
+
+// A HEAD response carries the GET response's Content-Length but no body,
+// so the response to a request pipelined behind it starts right after its
+// blank line
+static void check_head_then_get(const char *path, const char *body)
+{
+    char request[512];
+    snprintf(request, sizeof(request),
+             "HEAD %s HTTP/1.1\r\nHost: test\r\n\r\n"
+             "GET %s HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n",
+             path, path);
+
+    size_t len;
+    char *received = exchange(request, &len);
+
+    size_t first = head_length(received);
+    CHECK(first > 0);
+    CHECK(strncmp(received, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(content_length(received, first) == (long)strlen(body));
+
+    const char *second = received + first;
+    size_t second_head = head_length(second);
+    CHECK(strncmp(second, "HTTP/1.1 200 ", 13) == 0);
+    CHECK(content_length(second, second_head) == (long)strlen(body));
+    CHECK(second_head > 0 && strcmp(second + second_head, body) == 0);
+    CHECK(first + second_head + strlen(body) == len);
+    free(received);
+}
+
+// A body just under the limit sent in one-byte chunks is five times the
+// size of the read buffer on the wire, but only its decoded bytes count
+static void check_small_chunks()
+{
+    const char *head = "POST /upload HTTP/1.1\r\nHost: test\r\nConnection: close\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n";
+    size_t body_len = HTTP_MAX_BODY_BYTES - 1024;
+    char *request = (char *)malloc(strlen(head) + body_len * 6 + 6);
+    char *p = request + sprintf(request, "%s", head);
+    for (size_t i = 0; i < body_len; i++)
+    {
+        memcpy(p, "1\r\nx\r\n", 6);
+        p += 6;
+    }
+    sprintf(p, "0\r\n\r\n");
+
+    size_t len;
+    char *received = exchange(request, &len);
+    CHECK(strncmp(received, "HTTP/1.1 200 ", 13) == 0);
+    free(received);
+    free(request);
+}
+
+int main()
+{
+    port = 20000 + getpid() % 20000;
+
+    ASTNode *ast = parse_program(source);
+    CHECK(ast != NULL);
+    if (!ast)
+        return TEST_RESULT();
+
+    HTTPServer *server = http_server_create(port, ast);
+    server->log_requests = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_run, server);
+
+    check_head_then_get("/", "Welcome\n");               // Cached constant route
+    check_head_then_get("/hello/bob", "Hello, bob\n"); // Route run per request
+    check_head_then_get("/posts", "list\n");            // GET route answering HEAD
+    check_small_chunks();
+
+    http_server_stop(server);
+    pthread_join(thread, NULL);
+    http_server_free(server);
+    ast_free(ast);
+    return TEST_RESULT();
+}
@@ -0,0 +1,144 @@
+#include "test.h"
+#include "image.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Writes images of a compiled program, some of them tampered with after
+// compiling (so their checksums are still right), and checks which load
+
+static const char *source =
+    "memo function fib(n) {\n"
+    "    if n <= 1 {\n"
+    "        return n\n"
+    "    }\n"
+    "    return fib(n - 1) + fib(n - 2)\n"
+    "}\n"
+    "\n"
+    "function sum(n, total) {\n"
+    "    if n <= 0 {\n"
+    "        return total\n"
+    "    }\n"
+    "    return sum(n - 1, total + n)\n"
+    "}\n"
+    "\n"
+    "route \"/\" {\n"
+    "    response \"hi\"\n"
+    "}\n"
+    "\n"
+    "route \"/loop/:n\" {\n"
+    "    i = 0\n"
+    "    text = \"\"\n"
+    "    while i < n && i < 100 {\n"
+    "        text = text + i\n"
+    "        i = i + 1\n"
+    "    }\n"
+    "    if i > 5 || n == 0 {\n"
+    "        response text\n"
+    "    } else {\n"
+    "        response fib(i) + sum(i, 0)\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "route \"/if/:x\" {\n"
+    "    if x {\n"
+    "        response \"a\"\n"
+    "    }\n"
+    "}\n";
+
+static char path[64];
+
+static int loads(const BytecodeProgram *bytecode, const Router *router)
+{
+    if (image_write(path, bytecode, router) < 0)
+        return 0;
+    ProgramImage *image = image_open(path);
+    image_close(image);
+    return image != NULL;
+}
+
+// Index of the first instruction with opcode op in route's body
+static uint32_t find_op(const BytecodeProgram *bytecode, uint32_t route, Opcode op)
+{
+    const BytecodeRoute *body = &bytecode->routes[route];
+    for (uint32_t i = body->code_start; i < body->code_start + body->code_len; i++)
+    {
+        if (INSTR_OP(bytecode->code[i]) == op)
+            return i;
+    }
+    return body->code_start;
+}
+
+// Each change breaks the operand stack in a way only following its depth
+// catches: every operand and jump stays in range
+static void check_tampered_stack(BytecodeProgram *bytecode, const Router *router)
+{
+    // Pops an empty stack
+    uint32_t at = bytecode->routes[0].code_start;
+    Instruction saved = bytecode->code[at];
+    bytecode->code[at] = INSTR(OP_POP, 0);
+    CHECK(!loads(bytecode, router));
+    bytecode->code[at] = saved;
+
+    // Pushes more than the route claims
+    uint32_t max_stack = bytecode->routes[0].max_stack;
+    bytecode->routes[0].max_stack = 0;
+    CHECK(!loads(bytecode, router));
+    bytecode->routes[0].max_stack = max_stack;
+
+    // Leaves an operand behind on one side of the if only, so the two
+    // paths meet at different depths
+    at = find_op(bytecode, 2, OP_RESPOND);
+    saved = bytecode->code[at];
+    CHECK(INSTR_OP(saved) == OP_RESPOND);
+    bytecode->code[at] = INSTR(OP_APPEND_NAME, 0);
+    CHECK(!loads(bytecode, router));
+    bytecode->code[at] = saved;
+
+    CHECK(loads(bytecode, router));
+}
+
+// The server stores a resolved route's path parameters straight into its
+// frame, so the frame must have room for them
+static void check_tampered_params(BytecodeProgram *bytecode, const Router *router)
+{
+    BytecodeRoute *route = &bytecode->routes[1]; // "/loop/:n"
+    CHECK(route->resolved && router->routes[1].param_count == 1);
+    uint32_t slot_count = route->slot_count;
+    route->slot_count = 0;
+    CHECK(!loads(bytecode, router));
+    route->slot_count = slot_count;
+
+    route->resolved = 2;
+    CHECK(!loads(bytecode, router));
+    route->resolved = 1;
+
+    CHECK(loads(bytecode, router));
+}
+
+int main()
+{
+    snprintf(path, sizeof(path), "/tmp/webbubble-test-%d.bubc", (int)getpid());
+
+    ASTNode *ast = parse_program(source);
+    CHECK(ast != NULL);
+    if (!ast)
+        return TEST_RESULT();
+
+    BytecodeProgram *bytecode = bytecode_compile(ast);
+    Router *router = router_compile(ast);
+    CHECK(bytecode != NULL);
+    if (bytecode)
+    {
+        // Everything the compiler emits passes, loops, short-circuits and
+        // tail calls included
+        CHECK(loads(bytecode, router));
+        check_tampered_stack(bytecode, router);
+        check_tampered_params(bytecode, router);
+    }
+
+    unlink(path);
+    bytecode_free(bytecode);
+    router_free(router);
+    ast_free(ast);
+    return TEST_RESULT();
+}
@@ -0,0 +1,91 @@
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Programs nested too deeply for the passes that recurse over the tree are
+// rejected with a diagnostic rather than overflowing the stack
+
+// Parse source; returns 1 if it parsed, or 0 with the first error's message
+// in message
+static int parses(const char *source, char *message, size_t size)
+{
+    Lexer *lexer = lexer_init(source);
+    Parser *parser = parser_init(lexer);
+    ASTNode *ast = parser_parse(parser);
+    message[0] = '\0';
+    if (parser->diagnostics.count > 0)
+        snprintf(message, size, "%s", parser->diagnostics.items[0].message);
+    parser_free(parser);
+    lexer_free(lexer);
+    if (ast)
+    {
+        optimize_program(ast);
+        resolve_program(ast);
+        ast_free(ast);
+    }
+    return ast != NULL;
+}
+
+// A route "/" whose response is open repeated count times, then middle, then
+// close repeated count times
+static char *route_with(const char *open, const char *middle, const char *close, int count)
+{
+    size_t len = strlen("route \"/\" {\n    response \n}\n") +
+                 count * (strlen(open) + strlen(close)) + strlen(middle) + 1;
+    char *source = (char *)malloc(len);
+    char *p = source + sprintf(source, "route \"/\" {\n    response ");
+    for (int i = 0; i < count; i++)
+        p += sprintf(p, "%s", open);
+    p += sprintf(p, "%s", middle);
+    for (int i = 0; i < count; i++)
+        p += sprintf(p, "%s", close);
+    sprintf(p, "\n}\n");
+    return source;
+}
+
+static int nesting_ok(const char *open, const char *middle, const char *close, int count)
+{
+    char *source = route_with(open, middle, close, count);
+    char message[DIAGNOSTIC_MESSAGE_SIZE];
+    int ok = parses(source, message, sizeof(message));
+    free(source);
+    if (!ok && !strstr(message, "Nesting too deep"))
+        fprintf(stderr, "unexpected error: %s\n", message);
+    return ok;
+}
+
+static void check_nesting()
+{
+    // Parentheses and calls recurse in the parser
+    CHECK(nesting_ok("(", "1", ")", 100));
+    CHECK(!nesting_ok("(", "1", ")", 100000));
+    CHECK(nesting_ok("f(", "1", ")", 100));
+    CHECK(!nesting_ok("f(", "1", ")", 100000));
+
+    // Operator chains are parsed in a loop, but every later pass recurses
+    // down the tree they build
+    CHECK(nesting_ok("1 + ", "1", "", 200));
+    CHECK(!nesting_ok("1 + ", "1", "", 100000));
+    CHECK(!nesting_ok("1 * 2 + ", "1", "", 100000));
+
+    // Blocks, and chains of else if
+    CHECK(nesting_ok("html { response ", "1", " }", 100));
+    CHECK(!nesting_ok("html { response ", "1", " }", 100000));
+
+    int count = 100000;
+    char *source = (char *)malloc(count * 32 + 64);
+    char *p = source + sprintf(source, "route \"/\" {\n    ");
+    for (int i = 0; i < count; i++)
+        p += sprintf(p, "if 1 { response 1 } else ");
+    sprintf(p, "{ response 2 }\n}\n");
+    char message[DIAGNOSTIC_MESSAGE_SIZE];
+    CHECK(!parses(source, message, sizeof(message)));
+    CHECK(strstr(message, "Nesting too deep") != NULL);
+    free(source);
+}
+
+int main()
+{
+    check_nesting();
+    return TEST_RESULT();
+}
@@ -0,0 +1,170 @@
+#include "test.h"
+#include "router.h"
+#include "bytebuffer.h"
+#include <string.h>
+#include <time.h>
+
+static const char *source =
+    "route \"GET /posts\" {\n"
+    "    response \"list\"\n"
+    "}\n"
+    "\n"
+    "route \"POST /posts\" {\n"
+    "    response \"created\"\n"
+    "}\n"
+    "\n"
+    "route \"GET /status\" {\n"
+    "    response \"up\"\n"
+    "}\n"
+    "\n"
+    "route \"HEAD /status\" {\n"
+    "    response \"\"\n"
+    "}\n";
+
+static const char *user_source =
+    "route \"/user/me\" {\n"
+    "    response \"me\"\n"
+    "}\n"
+    "\n"
+    "route \"/user/:id\" {\n"
+    "    response id\n"
+    "}\n"
+    "\n"
+    "route \"/user/:id/posts\" {\n"
+    "    response id\n"
+    "}\n";
+
+static RouterResult match(const Router *router, int method, const char *path, RouteMatch *result)
+{
+    return router_match(router, method, path, strlen(path), result);
+}
+
+// HEAD is answered by the GET route unless it has one of its own, and is
+// allowed wherever GET is
+static void check_head(const Router *router)
+{
+    RouteMatch result;
+    CHECK(match(router, ROUTER_METHOD_HEAD, "/posts", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 0);
+    CHECK(match(router, ROUTER_METHOD_HEAD, "/status", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 3);
+    CHECK(match(router, ROUTER_METHOD_GET, "/status", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 2);
+
+    CHECK(match(router, ROUTER_METHOD_DELETE, "/posts", &result) == ROUTER_METHOD_NOT_ALLOWED);
+    CHECK(result.allowed == ((1u << ROUTER_METHOD_GET) | (1u << ROUTER_METHOD_HEAD) |
+                             (1u << ROUTER_METHOD_POST)));
+}
+
+// A static segment beats a parameter, and the choice is never revisited
+static void check_static_priority(const Router *router)
+{
+    RouteMatch result;
+    CHECK(match(router, ROUTER_METHOD_GET, "/user/me", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 0 && result.param_count == 0);
+    CHECK(match(router, ROUTER_METHOD_GET, "/user/42", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 1 && result.param_count == 1);
+    CHECK(strview_equals(result.params[0].value, "42"));
+    CHECK(match(router, ROUTER_METHOD_GET, "/user/42/posts", &result) == ROUTER_MATCHED);
+    CHECK(result.route == 2);
+    CHECK(match(router, ROUTER_METHOD_GET, "/user/me/posts", &result) == ROUTER_NOT_FOUND);
+}
+
+#define OVERLAP_DEPTH 14
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Every mix of "a" and ":p" segments, OVERLAP_DEPTH deep, then "x": route
+// k has a parameter wherever bit i of k is set. A matcher that went back to
+// try parameters would visit the whole trie, 2^15 nodes, before giving up
+// on ".../a/y"; walking it costs one step per segment.
+static void check_overlapping_routes()
+{
+    ByteBuffer source;
+    bytebuffer_init(&source);
+    for (int k = 0; k < 1 << OVERLAP_DEPTH; k++)
+    {
+        bytebuffer_append_str(&source, "route \"");
+        for (int i = 0; i < OVERLAP_DEPTH; i++)
+        {
+            if (k & (1 << i))
+                bytebuffer_appendf(&source, "/:p%d", i);
+            else
+                bytebuffer_append_str(&source, "/a");
+        }
+        bytebuffer_append_str(&source, "/x\" {\n    response \"x\"\n}\n");
+    }
+    bytebuffer_append(&source, "", 1);
+
+    ASTNode *ast = parse_program(source.data);
+    bytebuffer_free(&source);
+    CHECK(ast != NULL);
+    if (!ast)
+        return;
+    Router *router = router_compile(ast);
+
+    char all_static[3 * OVERLAP_DEPTH + 3];
+    char first_param[3 * OVERLAP_DEPTH + 3];
+    char dead_end[3 * OVERLAP_DEPTH + 3];
+    char *end = all_static;
+    for (int i = 0; i < OVERLAP_DEPTH; i++)
+    {
+        memcpy(end, "/a", 2);
+        end += 2;
+    }
+    strcpy(end, "/x");
+    strcpy(first_param, all_static);
+    first_param[1] = 'b';
+    strcpy(dead_end, all_static);
+    dead_end[strlen(dead_end) - 1] = 'y';
+
+    RouteMatch result;
+    CHECK(match(router, ROUTER_METHOD_GET, all_static, &result) == ROUTER_MATCHED);
+    CHECK(result.route == 0 && result.param_count == 0);
+    CHECK(match(router, ROUTER_METHOD_GET, first_param, &result) == ROUTER_MATCHED);
+    CHECK(result.route == 1 && result.param_count == 1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int not_found = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        not_found += match(router, ROUTER_METHOD_GET, dead_end, &result) == ROUTER_NOT_FOUND;
+    }
+    CHECK(not_found == 1000);
+    CHECK(elapsed_ms(&start) < 50);
+
+    router_free(router);
+    ast_free(ast);
+}
+
+int main()
+{
+    ASTNode *ast = parse_program(source);
+    CHECK(ast != NULL);
+    if (ast)
+    {
+        Router *router = router_compile(ast);
+        check_head(router);
+        router_free(router);
+        ast_free(ast);
+    }
+
+    ast = parse_program(user_source);
+    CHECK(ast != NULL);
+    if (ast)
+    {
+        Router *router = router_compile(ast);
+        check_static_priority(router);
+        router_free(router);
+        ast_free(ast);
+    }
+
+    check_overlapping_routes();
+    return TEST_RESULT();
+}